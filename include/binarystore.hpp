@@ -5,12 +5,21 @@
 
 #include <unistd.h>
 
+#include <array>
 #include <blobs-ipmid/blobs.hpp>
+#include <boost/container/flat_map.hpp>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
-#include <map>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 using std::size_t;
@@ -22,6 +31,93 @@ using std::uint8_t;
 namespace binstore
 {
 
+/* How the image is compressed in the sysfile */
+enum class Compression
+{
+    None,
+    Lz4, // Needs the lz4 build option
+};
+
+/* Layout of the image in the sysfile */
+enum class ImageFormat
+{
+    Proto, // Length-prefixed BinaryBlobBase proto (v1)
+    Flat,  // Header, sorted offset table and aligned payloads (v2)
+};
+
+/**
+ * @struct StoreOptions holds optional per-store behavior that does not affect
+ *     which data the store holds, only how it is persisted.
+ */
+struct StoreOptions
+{
+    /* If set, commit() compares the new image against the last persisted one
+     * in blocks of this many bytes and only rewrites the blocks that changed.
+     * Adjacent changed blocks are coalesced into a single write. */
+    std::optional<uint32_t> deltaCommitGranularity;
+    /* If true, loading only indexes the blob ids and where their payloads are
+     * in the sysfile. Payloads are read the first time a blob is opened or
+     * read, and all of them before a commit rewrites the sysfile. */
+    bool lazyLoad = false;
+    /* If set, the sysfile holds two slots of this many bytes and each commit
+     * writes the slot not holding the current image, followed by a header
+     * with a sequence number and checksums. Loading picks the newest slot
+     * whose image is intact, so an interrupted commit falls back to the
+     * previous image. Replaces delta commits when both are set. */
+    std::optional<uint32_t> slotSize;
+    /* Log engine only: compact the log once the records appended since the
+     * last compaction exceed this many bytes. Defaults to the size of the
+     * base they follow, so the log never gets much past twice the size of
+     * its base. */
+    std::optional<uint32_t> logCompactionThreshold;
+    /* If true, commit() encodes a snapshot of the store and returns right
+     * away, while a worker thread writes the snapshot to the sysfile. stat()
+     * reports committing until the write is done. Image engine only. */
+    bool asyncCommit = false;
+    /* If either is set, commit() only snapshots the store and acknowledges
+     * the commit. The latest snapshot is written by a worker thread once no
+     * commit came for |writeBackDelay|, once |writeBackDirtyBytes| bytes were
+     * written since the last write to the sysfile, or when a session closes
+     * or the store is destroyed. Closing reports if that write failed.
+     * Without a delay, a commit below the threshold waits for a session to
+     * close. Image engine only. */
+    std::optional<std::chrono::milliseconds> writeBackDelay;
+    std::optional<uint32_t> writeBackDirtyBytes;
+    /* If set, commit() compresses the proto of the image, and the max size
+     * applies to the compressed image. Compressed images are always loaded
+     * whole, so lazy loading has no effect on them. Image engine only. */
+    Compression compression = Compression::None;
+    /* Format of the first image written to a sysfile holding none. A loaded
+     * image keeps its format across commits until it is changed with
+     * BinaryStore::setImageFormat(). Flat images are never compressed. */
+    ImageFormat format = ImageFormat::Proto;
+    /* If true, commits of proto images store the CRC32C of each blob, which
+     * counts against the max size. Flat images always hold one. Checksums
+     * found on load are verified either way. */
+    bool checksums = false;
+};
+
+/**
+ * @struct CommitStats reports how much data commits pushed to the sysfile.
+ */
+struct CommitStats
+{
+    /* Number of commits that reached the sysfile */
+    uint64_t commits = 0;
+    /* Number of bytes actually written to the sysfile */
+    uint64_t bytesWritten = 0;
+};
+
+/**
+ * @struct StoreSession is the state of a session that has a blob open.
+ */
+struct StoreSession
+{
+    std::string blobId;
+    /* True if the blob is open for writing */
+    bool writable = false;
+};
+
 /**
  * @class BinaryStore instantiates a concrete implementation of
  *     BinaryStoreInterface. The dependency on file is injected through its
@@ -38,23 +134,34 @@ class BinaryStore : public BinaryStoreInterface
         Dirty = (1 << 8), // In-memory data might not match persisted data
         Clean = (1 << 9), // In-memory data matches persisted data
         Uninitialized = (1 << 10), // Cannot find persisted data
-        CommitError = (1 << 11)    // Error happened during committing
+        CommitError = (1 << 11),   // Error happened during committing
+        ChecksumError = (1 << 12), // Persisted data failed its checksum
+        Loading = (1 << 13)        // Store is still being loaded
     };
 
     BinaryStore() = delete;
     BinaryStore(const std::string& baseBlobId, std::unique_ptr<SysFile> file,
-                std::optional<uint32_t> maxSize = std::nullopt) :
-        baseBlobId_(baseBlobId), file_(std::move(file)), maxSize(maxSize)
+                std::optional<uint32_t> maxSize = std::nullopt,
+                const StoreOptions& options = {}) :
+        baseBlobId_(baseBlobId), file_(std::move(file)), maxSize(maxSize),
+        options_(options)
     {
+        setupSlots();
+        recalcEncodedSize();
     }
 
     BinaryStore(std::unique_ptr<SysFile> file, bool readOnly = false,
-                std::optional<uint32_t> maxSize = std::nullopt) :
-        readOnly_{readOnly}, file_(std::move(file)), maxSize(maxSize)
+                std::optional<uint32_t> maxSize = std::nullopt,
+                const StoreOptions& options = {}) :
+        readOnly_{readOnly}, file_(std::move(file)), maxSize(maxSize),
+        options_(options)
     {
+        setupSlots();
+        recalcEncodedSize();
     }
 
-    ~BinaryStore() = default;
+    /* Writes a commit still held back by write-back coalescing */
+    ~BinaryStore();
 
     BinaryStore(const BinaryStore&) = delete;
     BinaryStore& operator=(const BinaryStore&) = delete;
@@ -64,26 +171,54 @@ class BinaryStore : public BinaryStoreInterface
     std::string getBaseBlobId() const override;
     bool setBaseBlobId(const std::string& baseBlobId) override;
     std::vector<std::string> getBlobIds() const override;
-    bool openOrCreateBlob(const std::string& blobId, uint16_t flags) override;
+    uint64_t getBlobIdsGeneration() const override;
+    bool openOrCreateBlob(uint16_t session, const std::string& blobId,
+                          uint16_t flags) override;
     bool deleteBlob(const std::string& blobId) override;
-    std::vector<uint8_t> read(uint32_t offset, uint32_t requestedSize) override;
+    std::span<const uint8_t> readView(uint16_t session, uint32_t offset,
+                                      uint32_t requestedSize) override;
     std::vector<uint8_t> readBlob(const std::string& blobId) const override;
-    bool write(uint32_t offset, const std::vector<uint8_t>& data) override;
-    bool commit() override;
-    bool close() override;
+    std::span<const uint8_t> readBlobView(const std::string& blobId) override;
+    using BinaryStoreInterface::write;
+    bool write(uint16_t session, uint32_t offset,
+               std::span<const uint8_t> data) override;
+    bool commit(uint16_t session) override;
+    bool close(uint16_t session) override;
     bool stat(blobs::BlobMeta* meta) override;
+    bool statBlob(const std::string& blobId, blobs::BlobMeta* meta) override;
+    bool stat(uint16_t session, blobs::BlobMeta* meta) override;
+
+    /**
+     * @returns counters of the data written to the sysfile by commits.
+     */
+    const CommitStats& getCommitStats() const;
+
+    /**
+     * Rewrites the sysfile in |format|, which later commits keep. Fails if
+     * the store is read only, has open sessions or if the sysfile holds no
+     * store.
+     * @returns True if the sysfile holds the store in |format|
+     */
+    bool setImageFormat(ImageFormat format);
+
+    /**
+     * @returns the format of the image loaded from or written to the sysfile
+     */
+    ImageFormat getImageFormat() const;
 
     /**
      * Helper factory method to create a BinaryStore instance
      * @param baseBlobId: base id for the created instance
      * @param sysFile: system file object for storing binary
+     * @param options: optional persistence behavior of the store
      * @returns unique_ptr to constructed BinaryStore. Caller should take
      *     ownership of the instance.
      */
     static std::unique_ptr<BinaryStoreInterface> createFromConfig(
         const std::string& baseBlobId, std::unique_ptr<SysFile> file,
         std::optional<uint32_t> maxSize = std::nullopt,
-        std::optional<std::string> aliasBlobBaseId = std::nullopt);
+        std::optional<std::string> aliasBlobBaseId = std::nullopt,
+        const StoreOptions& options = {});
 
     /**
      * Helper factory method to create a BinaryStore instance
@@ -91,27 +226,301 @@ class BinaryStore : public BinaryStoreInterface
      * the baseBlobId name from the storage.
      * @param sysFile: system file object for storing binary
      * @param readOnly: if true, open the store in read only mode
+     * @param options: optional persistence behavior of the store
      * @returns unique_ptr to constructed BinaryStore.
      */
     static std::unique_ptr<BinaryStoreInterface>
         createFromFile(std::unique_ptr<SysFile> file, bool readOnly = true,
-                       std::optional<uint32_t> maxSize = std::nullopt);
+                       std::optional<uint32_t> maxSize = std::nullopt,
+                       const StoreOptions& options = {});
 
   private:
+    /* A blob payload. Until a blob gets its own copy in |data|, the payload
+     * is referenced where it was loaded from: |arena_|, or the sysfile in
+     * lazy mode. */
+    struct Blob
+    {
+        std::vector<uint8_t> data;
+        /* Position of the not yet owned payload in the arena or sysfile */
+        std::optional<size_t> offset;
+        size_t storedSize = 0;
+        /* CRC32C of the payload as persisted, unset once the payload changes
+         * until the next commit computes it */
+        std::optional<uint32_t> crc;
+        /* The persisted payload doesn't match its CRC32C */
+        bool checksumError = false;
+        /* Place of the payload in a flat image, 0 if it has none yet */
+        uint32_t flatOffset = 0;
+        uint32_t flatCapacity = 0;
+        /* Bytes of that place that might not match the sysfile since the last
+         * commit that was written, and the |generation_| they last changed */
+        uint32_t flatDirtyBegin = 0;
+        uint32_t flatDirtyEnd = 0;
+        uint64_t flatDirtyGeneration = 0;
+
+        size_t size() const
+        {
+            return offset ? storedSize : data.size();
+        }
+
+        /* Payload bytes, not valid for a payload left in the sysfile */
+        std::span<const uint8_t> bytes(std::string_view arena) const
+        {
+            if (!offset)
+            {
+                return data;
+            }
+            return {reinterpret_cast<const uint8_t*>(arena.data()) + *offset,
+                    storedSize};
+        }
+    };
+
+    /* Blobs sorted by their id relative to the base id in contiguous
+     * storage, so renaming the base id leaves them alone. The comparator is
+     * transparent, so lookups take any string-like id. */
+    using BlobMap =
+        boost::container::flat_map<std::string, Blob, std::less<>>;
+
+    /* A session with the position of its blob in |blobs_|, so reads and
+     * writes don't search for it. Adding or removing blobs shifts the
+     * position, so it is checked before use. */
+    struct Session : StoreSession
+    {
+        size_t blobIndex;
+    };
+
+    /* The blob open in |session| */
+    Blob& sessionBlob(Session& session);
+
     /* Load the serialized data from sysfile if commit state is dirty.
      * Returns False if encountered error when loading */
     bool loadSerializedData(
         std::optional<std::string> aliasBlobBaseId = std::nullopt);
 
-    std::map<std::string, std::vector<std::uint8_t>> blobs_;
-    std::string baseBlobId_, currentBlob_;
-    /* True if current blob is writable */
-    bool writable_ = false;
+    /* Decode the image in |imageFile()| into |blobs_|. Returns False if it
+     * isn't a valid image.
+     * @throws std::system_error if the sysfile can't be read */
+    bool decodeImage(std::string& protoBlobId);
+
+    /* Decode the flat image in |imageFile()| into |blobs_|. Returns False if
+     * it isn't a valid flat image.
+     * @throws std::system_error if the sysfile can't be read */
+    bool decodeFlatImage(std::string& protoBlobId);
+
+    /* Rekey the blobs decoded from a proto image by their id relative to
+     * |baseId|, dropping any blob outside of it */
+    void makeIdsRelative(std::string_view baseId);
+
+    /* Decode the image of the newest slot that holds a valid one, and make
+     * that slot the active one. Returns False if neither slot is valid.
+     * @throws std::system_error if the sysfile can't be read */
+    bool decodeNewestSlot(std::string& protoBlobId);
+
+    /* Create the views of both slots in A/B mode */
+    void setupSlots();
+
+    /* Sysfile holding the current image: the active slot in A/B mode */
+    SysFile& imageFile() const;
+
+    /* Write the in-memory data to the sysfile */
+    bool persist();
+
+    /* Part of an image to write at |pos| of |file| */
+    struct ImageWrite
+    {
+        SysFile* file;
+        size_t pos;
+        std::string data;
+    };
+
+    /* The writes of a snapshot image, and what they change once done */
+    struct SnapshotCommit
+    {
+        std::vector<ImageWrite> writes;
+        /* |generation_| of the snapshot */
+        uint64_t generation;
+        /* The snapshot, kept as |persistedImage_| for delta commits. Only the
+         * index of a flat image. */
+        std::string image;
+        size_t bytesWritten;
+        /* Slot that becomes the active one in A/B mode */
+        std::optional<size_t> slot;
+    };
+
+    /* A snapshot commit whose writes were handed to the worker thread */
+    struct AsyncCommit
+    {
+        std::future<void> done;
+        SnapshotCommit commit;
+    };
+
+    /* Lets the worker holding back a commit write it before its deadline,
+     * or drop it once a later commit replaces it */
+    struct WriteBackTimer
+    {
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool due = false;
+        bool dropped = false;
+    };
+
+    /* A commit acknowledged but not written yet by write-back coalescing.
+     * With a delay, a worker thread writes it once the delay is over, and
+     * owns its writes. */
+    struct WriteBack
+    {
+        SnapshotCommit commit;
+        /* True once the worker wrote the commit, False if it was dropped */
+        std::future<bool> written;
+        std::shared_ptr<WriteBackTimer> timer;
+    };
+
+    /* Plan the writes of |image|, the snapshot of |generation| */
+    SnapshotCommit planSnapshot(std::string image, uint64_t generation) const;
+
+    /* Update the store once the writes of |commit| are done */
+    void applySnapshot(SnapshotCommit& commit);
+
+    /* Write a planned snapshot, on the worker thread in async mode */
+    bool writeSnapshot(SnapshotCommit commit);
+
+    /* Record that a commit failed and might have left a partial image */
+    void commitFailed(const std::exception& e);
+
+    /* Start writing |commit| to the sysfile on the worker thread */
+    void startAsyncCommit(SnapshotCommit commit);
+
+    /* Hold |commit| back, on a worker thread that writes it once the
+     * write-back delay is over if there is one */
+    void holdBack(SnapshotCommit commit);
+
+    /* Write the commit held back by write-back coalescing if |force| is set,
+     * or apply it if the worker already wrote it. Returns False if writing
+     * it failed. */
+    bool flushWriteBack(bool force);
+
+    /* Drop the commit held back by write-back coalescing before a later
+     * commit replaces it, unless the worker already wrote it */
+    void dropWriteBack();
+
+    /* Apply the result of the worker writing the held-back commit, once it
+     * is done. Returns False if writing it failed. */
+    bool finishWriteBack();
+
+    /* Apply the result of the commit running on the worker thread once it is
+     * done, waiting for it if |wait| is set. Returns False if it is still
+     * running. */
+    bool finishAsyncCommit(bool wait);
+
+    /* Whether the current changes are covered by a commit, written or held
+     * back by write-back coalescing */
+    bool changesCommitted() const;
+
+    /* Blob state flags of the store, without the open flags of a session */
+    uint16_t commitStateFlags() const;
+
+    /* Whether the image decoded from the active slot matches the size and
+     * CRC32C its header records, past the length prefix. Payloads left in
+     * the sysfile are read in chunks to check them. */
+    bool slotImageIntact(uint64_t protoSize, uint32_t protoCrc) const;
+
+    /* Make the inactive slot the active one once it holds an image of
+     * |imageSize| bytes, whose proto has the CRC32C |protoCrc|. */
+    void commitToSlot(uint32_t protoCrc, size_t imageSize);
+
+    /* Header making the inactive slot the active one, see commitToSlot() */
+    ImageWrite slotHeaderWrite(uint32_t protoCrc, size_t imageSize) const;
+
+    /* Largest image, length prefix included, that can be committed */
+    size_t maxImageSize() const;
+
+    /* Largest image before compression that might still fit the max size */
+    size_t maxEncodedSize() const;
+
+    /* Recompute |encodedSize_| from scratch. Only needed when the base id or
+     * the whole set of blobs changes; writes update the tally in place. */
+    void recalcEncodedSize();
+
+    /* Bytes a blob adds to |encodedSize_| in the current image format.
+     * |idSize| is the size of the id relative to the base id. */
+    size_t entrySize(size_t idSize, size_t dataSize) const;
+
+    /* The part of |blobId| following the base id, which keys |blobs_|.
+     * Unset if |blobId| doesn't start with the base id. */
+    std::optional<std::string_view> relativeId(std::string_view blobId) const;
+
+    /* Place the payloads of a flat image, keeping their previous place where
+     * possible, and pass each write the commit takes to |write|: the payload
+     * blocks that might not match the sysfile, in chunks, then the blocks of
+     * the index that changed. Returns the commit without its writes. */
+    SnapshotCommit
+        planFlatCommit(const std::function<void(ImageWrite)>& write);
+
+    /* Delta commit of |image|: write only the blocks that differ from
+     * |persistedImage_|, or all of it if nothing is known to be persisted. */
+    void writeImage(const std::string& image);
+
+    /* Writes of the blocks of |image| that differ from |persistedImage_| */
+    std::vector<ImageWrite> deltaWrites(const std::string& image) const;
+
+    /* Copy of the payload of a blob.
+     * @throws std::system_error or std::runtime_error if it is left in the
+     *     sysfile and can't be read */
+    std::vector<uint8_t> readPayload(const Blob& blob) const;
+
+    /* Give |blob| its own copy of the payload if it doesn't have one yet */
+    void ownBlob(Blob& blob);
+
+    /* Whether payloads not owned by their blob are left in the sysfile
+     * rather than in |arena_| */
+    bool payloadsInSysfile() const;
+
+    /* Flag |blob| if |payload| doesn't match its persisted CRC32C. Returns
+     * False if it doesn't. */
+    static bool verifyChecksum(Blob& blob, std::span<const uint8_t> payload);
+
+    BlobMap blobs_;
+    /* Proto read at load time, holding the payloads of unmodified blobs */
+    std::string arena_;
+    /* The loaded image was compressed, |arena_| holds it decompressed */
+    bool compressedImage_ = false;
+    std::string baseBlobId_;
+    /* Sessions with an open blob, by session id */
+    std::unordered_map<uint16_t, Session> sessions_;
     /* True if the entire store (not just individual blobs) is read only */
     bool readOnly_ = false;
     std::unique_ptr<SysFile> file_ = nullptr;
+    /* Views of |file_| holding the image of each slot in A/B mode */
+    std::array<std::unique_ptr<SysFile>, 2> slots_;
+    size_t activeSlot_ = 0;
+    /* Sequence number of the newest slot header */
+    uint64_t slotSequence_ = 0;
     CommitState commitState_ = CommitState::Dirty;
     std::optional<uint32_t> maxSize;
+    /* Serialized size of the store, including the length prefix */
+    size_t encodedSize_ = 0;
+    StoreOptions options_;
+    /* Format of the image in the sysfile, or of the next one written */
+    ImageFormat imageFormat_ = options_.format;
+    /* Image last written to or read from the sysfile, only its index for a
+     * flat image. Only kept for delta commits, empty if unknown. */
+    std::string persistedImage_;
+    CommitStats commitStats_;
+    /* Commit running on the worker thread in async mode. The sysfile is only
+     * accessed by the worker until it is done. */
+    std::optional<AsyncCommit> asyncCommit_;
+    /* Commit held back by write-back coalescing. The sysfile is only
+     * accessed by its worker, if any, until it is done. */
+    std::optional<WriteBack> writeBack_;
+    /* Bytes written since the sysfile was last written, with write-back */
+    size_t dirtyBytes_ = 0;
+    /* Bumped every time the in-memory content changes */
+    uint64_t generation_ = 0;
+    /* Bumped every time the set of blob ids changes */
+    uint64_t blobIdsGeneration_ = 0;
+    /* |generation_| that matches the sysfile content (or its absence when
+     * uninitialized), unset if unknown */
+    std::optional<uint64_t> persistedGeneration_;
 };
 
 } // namespace binstore
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <blobs-ipmid/blobs.hpp>
 #include <cstdint>
 #include <memory>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -18,6 +20,11 @@ namespace binstore
 /**
  * @class BinaryStoreInterface is an abstraction for a storage location.
  *     Each instance would be uniquely identified by a baseId string.
+ *     Several sessions can have blobs of the store open at the same time,
+ *     each identified by the session id of the blob handler. A blob can be
+ *     open for reading in any number of sessions but for writing in only one.
+ *     All sessions share the in-memory data of the store, so a commit from
+ *     any session persists the changes made through all of them.
  */
 class BinaryStoreInterface
 {
@@ -41,13 +48,21 @@ class BinaryStoreInterface
      */
     virtual std::vector<std::string> getBlobIds() const = 0;
 
+    /**
+     * @returns Counter bumped whenever the list returned by getBlobIds()
+     *          may have changed, e.g. when a blob is created or deleted, the
+     *          base id is renamed or the store is reloaded.
+     */
+    virtual uint64_t getBlobIdsGeneration() const = 0;
+
     /**
      * Opens a blob given its name. If there is no one, create one.
+     * @param session: The session to open the blob in.
      * @param blobId: The blob id to operate on.
      * @param flags: Either read flag or r/w flag has to be specified.
      * @returns True if open/create successfully.
      */
-    virtual bool openOrCreateBlob(const std::string& blobId,
+    virtual bool openOrCreateBlob(uint16_t session, const std::string& blobId,
                                   uint16_t flags) = 0;
 
     /**
@@ -58,14 +73,46 @@ class BinaryStoreInterface
     virtual bool deleteBlob(const std::string& blobId) = 0;
 
     /**
-     * Reads data from the currently opened blob.
+     * Reads data from the blob opened in a session without copying it.
+     * @param session: The session the blob is open in.
+     * @param offset: offset into the blob to read
+     * @param requestedSize: how many bytes to read
+     * @returns View of the bytes able to read, valid until the store is next
+     *          modified or reloaded. Returns empty if nothing can be read or
+     *          if there is no open blob.
+     */
+    virtual std::span<const uint8_t> readView(uint16_t session,
+                                              uint32_t offset,
+                                              uint32_t requestedSize) = 0;
+
+    /**
+     * Reads data from the blob opened in a session.
+     * @param session: The session the blob is open in.
      * @param offset: offset into the blob to read
      * @param requestedSize: how many bytes to read
      * @returns Bytes able to read. Returns empty if nothing can be read or
      *          if there is no open blob.
      */
-    virtual std::vector<uint8_t> read(uint32_t offset,
-                                      uint32_t requestedSize) = 0;
+    virtual std::vector<uint8_t> read(uint16_t session, uint32_t offset,
+                                      uint32_t requestedSize)
+    {
+        const auto data = readView(session, offset, requestedSize);
+        return {data.begin(), data.end()};
+    }
+
+    /**
+     * Reads data from the blob opened in a session into a caller buffer.
+     * @param session: The session the blob is open in.
+     * @param offset: offset into the blob to read
+     * @param buf: receives up to buf.size() bytes
+     * @returns Number of bytes read into |buf|.
+     */
+    size_t readInto(uint16_t session, uint32_t offset, std::span<uint8_t> buf)
+    {
+        const auto data = readView(session, offset, buf.size());
+        std::copy(data.begin(), data.end(), buf.begin());
+        return data.size();
+    }
 
     /**
      * Reads all data from the blob
@@ -76,32 +123,73 @@ class BinaryStoreInterface
     virtual std::vector<uint8_t> readBlob(const std::string& blobId) const = 0;
 
     /**
-     * Writes data to the currently opened blob.
+     * Reads all data from the blob without copying it
+     * @param blobId: The blob id to operate on.
+     * @returns View of the data, valid until the store is next modified or
+     *          reloaded.
+     * @throws ipmi::HandlerCompletion if there is no such blob
+     */
+    virtual std::span<const uint8_t>
+        readBlobView(const std::string& blobId) = 0;
+
+    /**
+     * Writes data to the blob opened for writing in a session.
+     * @param session: The session the blob is open in.
      * @param offset: offset into the blob to write
      * @param data: bytes to write
      * @returns True if able to write the entire data successfully
      */
-    virtual bool write(uint32_t offset, const std::vector<uint8_t>& data) = 0;
+    virtual bool write(uint16_t session, uint32_t offset,
+                       std::span<const uint8_t> data) = 0;
+
+    virtual bool write(uint16_t session, uint32_t offset,
+                       const std::vector<uint8_t>& data)
+    {
+        return write(session, offset, std::span<const uint8_t>(data));
+    }
 
     /**
-     * Commits data to the persistent storage specified during blob init.
+     * Commits data of the whole store to the persistent storage specified
+     * during blob init.
+     * @param session: The session requesting the commit.
      * @returns True if able to write data to sysfile successfully
      */
-    virtual bool commit() = 0;
+    virtual bool commit(uint16_t session) = 0;
 
     /**
-     * Closes blob, which prevents further modifications. Uncommitted data will
-     * be lost.
+     * Closes the blob opened in a session, which prevents further
+     * modifications through it. Uncommitted data will be lost once no
+     * session is left open.
+     * @param session: The session to close.
      * @returns True if able to close the blob successfully
      */
-    virtual bool close() = 0;
+    virtual bool close(uint16_t session) = 0;
 
     /**
-     * Returns blob stat flags.
+     * Returns stat flags of the store, without any session specific state.
      * @param meta: output stat flags.
      * @returns True if able to get the stat flags and write to *meta
      */
     virtual bool stat(blobs::BlobMeta* meta) = 0;
+
+    /**
+     * Returns stat flags and size of a blob without opening it. Sessions
+     * are left alone and, in lazy mode, the payload isn't read.
+     * @param blobId: The blob id to operate on. The base id, or a blob that
+     *                doesn't exist, gets the stat flags of the store.
+     * @param meta: output stat flags.
+     * @returns True if able to get the stat flags and write to *meta
+     */
+    virtual bool statBlob(const std::string& blobId,
+                          blobs::BlobMeta* meta) = 0;
+
+    /**
+     * Returns blob stat flags of the blob opened in a session.
+     * @param session: The session the blob is open in.
+     * @param meta: output stat flags.
+     * @returns True if able to get the stat flags and write to *meta
+     */
+    virtual bool stat(uint16_t session, blobs::BlobMeta* meta) = 0;
 };
 
 } // namespace binstore
@@ -6,11 +6,13 @@
 
 #include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
 #include <gmock/gmock.h>
 
+using ::testing::_;
 using ::testing::Invoke;
 
 namespace binstore
@@ -37,28 +39,69 @@ class MockBinaryStore : public BinaryStoreInterface
         ON_CALL(*this, read)
             .WillByDefault(Invoke(&real_store_, &BinaryStore::read));
         ON_CALL(*this, write)
-            .WillByDefault(Invoke(&real_store_, &BinaryStore::write));
+            .WillByDefault(Invoke(
+                &real_store_,
+                static_cast<bool (BinaryStore::*)(
+                    uint16_t, uint32_t, const std::vector<uint8_t>&)>(
+                    &BinaryStore::write)));
         ON_CALL(*this, commit)
             .WillByDefault(Invoke(&real_store_, &BinaryStore::commit));
-        ON_CALL(*this, stat)
-            .WillByDefault(Invoke(&real_store_, &BinaryStore::stat));
+        ON_CALL(*this, stat(_))
+            .WillByDefault(Invoke(
+                &real_store_,
+                static_cast<bool (BinaryStore::*)(blobs::BlobMeta*)>(
+                    &BinaryStore::stat)));
+        ON_CALL(*this, stat(_, _))
+            .WillByDefault(Invoke(
+                &real_store_,
+                static_cast<bool (BinaryStore::*)(uint16_t, blobs::BlobMeta*)>(
+                    &BinaryStore::stat)));
     }
     MOCK_CONST_METHOD0(getBaseBlobId, std::string());
     MOCK_CONST_METHOD0(getBlobIds, std::vector<std::string>());
     MOCK_METHOD1(setBaseBlobId, bool(const std::string&));
-    MOCK_METHOD2(openOrCreateBlob, bool(const std::string&, uint16_t));
+    MOCK_METHOD3(openOrCreateBlob,
+                 bool(uint16_t, const std::string&, uint16_t));
     MOCK_METHOD1(deleteBlob, bool(const std::string&));
-    MOCK_METHOD2(read, std::vector<uint8_t>(uint32_t, uint32_t));
-    MOCK_METHOD2(write, bool(uint32_t, const std::vector<uint8_t>&));
-    MOCK_METHOD0(commit, bool());
-    MOCK_METHOD0(close, bool());
+    MOCK_METHOD3(read, std::vector<uint8_t>(uint16_t, uint32_t, uint32_t));
+    MOCK_METHOD3(write, bool(uint16_t, uint32_t, const std::vector<uint8_t>&));
+    MOCK_METHOD1(commit, bool(uint16_t));
+    MOCK_METHOD1(close, bool(uint16_t));
     MOCK_METHOD1(stat, bool(blobs::BlobMeta* meta));
+    MOCK_METHOD2(stat, bool(uint16_t, blobs::BlobMeta* meta));
 
     std::vector<uint8_t> readBlob(const std::string& blobId) const override
     {
         return real_store_.readBlob(blobId);
     }
 
+    std::span<const uint8_t> readBlobView(const std::string& blobId) override
+    {
+        return real_store_.readBlobView(blobId);
+    }
+
+    bool statBlob(const std::string& blobId, blobs::BlobMeta* meta) override
+    {
+        return real_store_.statBlob(blobId, meta);
+    }
+
+    uint64_t getBlobIdsGeneration() const override
+    {
+        return real_store_.getBlobIdsGeneration();
+    }
+
+    std::span<const uint8_t> readView(uint16_t session, uint32_t offset,
+                                      uint32_t requestedSize) override
+    {
+        return real_store_.readView(session, offset, requestedSize);
+    }
+
+    bool write(uint16_t session, uint32_t offset,
+               std::span<const uint8_t> data) override
+    {
+        return real_store_.write(session, offset, data);
+    }
+
   private:
     BinaryStore real_store_;
 };
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace binstore
+{
+
+/**
+ * @brief Computes the CRC32C (Castagnoli) checksum of data, with the CRC32C
+ *     instructions of the CPU when it has them
+ * @param data The bytes to checksum
+ * @param crc Checksum of the data preceding 'data', to checksum data in pieces
+ * @returns The checksum of the preceding data followed by 'data'
+ */
+uint32_t crc32c(std::span<const uint8_t> data, uint32_t crc = 0);
+
+/**
+ * @brief Same as crc32c(), using table lookups (slicing-by-8) only
+ */
+uint32_t crc32cPortable(std::span<const uint8_t> data, uint32_t crc = 0);
+
+inline uint32_t crc32c(std::string_view data, uint32_t crc = 0)
+{
+    return crc32c({reinterpret_cast<const uint8_t*>(data.data()), data.size()},
+                  crc);
+}
+
+} // namespace binstore
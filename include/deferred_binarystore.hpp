@@ -0,0 +1,89 @@
+#pragma once
+
+#include "binarystore.hpp"
+#include "binarystore_interface.hpp"
+
+#include <blobs-ipmid/blobs.hpp>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace binstore
+{
+
+/**
+ * @class DeferredBinaryStore stands in for a store that is still being
+ *     opened and loaded on a background thread, so registering it doesn't
+ *     wait on its sysfile. The base id is known right away for routing and
+ *     is the only id listed until the store is loaded, while stat reports the
+ *     OEM Loading flag. Any other call waits for the load to finish, then
+ *     goes to the loaded store.
+ */
+class DeferredBinaryStore : public BinaryStoreInterface
+{
+  public:
+    using CommitState = BinaryStore::CommitState;
+    /* Opens and loads the store, nullptr if it can't be created */
+    using Loader = std::function<std::unique_ptr<BinaryStoreInterface>()>;
+
+    DeferredBinaryStore() = delete;
+    DeferredBinaryStore(
+        const std::string& baseBlobId,
+        std::future<std::unique_ptr<BinaryStoreInterface>> loading);
+
+    ~DeferredBinaryStore() = default;
+
+    DeferredBinaryStore(const DeferredBinaryStore&) = delete;
+    DeferredBinaryStore& operator=(const DeferredBinaryStore&) = delete;
+    DeferredBinaryStore(DeferredBinaryStore&&) = default;
+    DeferredBinaryStore& operator=(DeferredBinaryStore&&) = default;
+
+    std::string getBaseBlobId() const override;
+    bool setBaseBlobId(const std::string& baseBlobId) override;
+    std::vector<std::string> getBlobIds() const override;
+    uint64_t getBlobIdsGeneration() const override;
+    bool openOrCreateBlob(uint16_t session, const std::string& blobId,
+                          uint16_t flags) override;
+    bool deleteBlob(const std::string& blobId) override;
+    std::span<const uint8_t> readView(uint16_t session, uint32_t offset,
+                                      uint32_t requestedSize) override;
+    std::vector<uint8_t> readBlob(const std::string& blobId) const override;
+    std::span<const uint8_t> readBlobView(const std::string& blobId) override;
+    using BinaryStoreInterface::write;
+    bool write(uint16_t session, uint32_t offset,
+               std::span<const uint8_t> data) override;
+    bool commit(uint16_t session) override;
+    bool close(uint16_t session) override;
+    bool stat(blobs::BlobMeta* meta) override;
+    bool statBlob(const std::string& blobId, blobs::BlobMeta* meta) override;
+    bool stat(uint16_t session, blobs::BlobMeta* meta) override;
+
+    /**
+     * Helper factory method to load a store on a background thread
+     * @param baseBlobId: base id of the store being loaded
+     * @param load: opens and loads the store, called on the background thread
+     * @returns unique_ptr to the deferred store
+     */
+    static std::unique_ptr<BinaryStoreInterface>
+        createInBackground(const std::string& baseBlobId, Loader load);
+
+  private:
+    /* Take the loaded store once loading is done. With |wait|, blocks until
+     * it is. Returns False if it is still loading. */
+    bool finishLoading(bool wait) const;
+
+    /* The loaded store after waiting for it, nullptr if loading failed */
+    BinaryStoreInterface* loadedStore() const;
+
+    std::string baseBlobId_;
+    /* Loading is finished by const calls too, which don't change what the
+     * store holds */
+    mutable std::future<std::unique_ptr<BinaryStoreInterface>> loading_;
+    mutable std::unique_ptr<BinaryStoreInterface> store_;
+};
+
+} // namespace binstore
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "sys_file.hpp"
+
+#include <boost/endian/arithmetic.hpp>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace binstore::flat
+{
+
+/**
+ * A flat (v2) image lays a store out so that each blob can be found and
+ * rewritten without decoding the others:
+ *
+ *   Header | Entry table, sorted by id | base id, blob ids | payloads
+ *
+ * Blob ids are stored relative to the base id. All integers are little
+ * endian. Each payload starts at a multiple of |alignment| and owns
+ * |capacity| bytes, so a payload that changes without outgrowing them is
+ * rewritten in place along with its table entry.
+ */
+struct Header
+{
+    boost::endian::little_uint32_t magic;
+    boost::endian::little_uint16_t version;
+    boost::endian::little_uint16_t alignment;
+    /* CRC32C of the rest of the header, the table and the ids */
+    boost::endian::little_uint32_t indexCrc;
+    boost::endian::little_uint32_t count;
+    boost::endian::little_uint32_t baseIdSize;
+    /* Total size of the blob ids following the base id */
+    boost::endian::little_uint32_t idsSize;
+    boost::endian::little_uint64_t imageSize;
+};
+
+struct Entry
+{
+    /* Position of the id among the blob ids */
+    boost::endian::little_uint32_t idOffset;
+    boost::endian::little_uint32_t idSize;
+    /* Position of the payload from the start of the image */
+    boost::endian::little_uint32_t offset;
+    boost::endian::little_uint32_t length;
+    boost::endian::little_uint32_t capacity;
+    /* CRC32C of the payload */
+    boost::endian::little_uint32_t crc;
+};
+
+static_assert(sizeof(Header) == 32 && sizeof(Entry) == 24);
+
+constexpr uint32_t magic = 0x32565342; // "BSV2" on disk
+constexpr uint16_t version = 2;
+constexpr uint16_t alignment = 8;
+
+/* Bytes a payload of |size| bytes owns once packed */
+constexpr size_t alignUp(size_t size)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+/* Where the payload of a blob is in a flat image */
+struct Extent
+{
+    std::string id;
+    /* 0 if the payload has no place yet */
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    /* Bytes owned by the payload */
+    uint32_t capacity = 0;
+    uint32_t crc = 0;
+};
+
+/* Header, table and ids of a flat image */
+struct Index
+{
+    std::string baseId;
+    /* Sorted by id */
+    std::vector<Extent> blobs;
+    size_t imageSize = 0;
+    /* Bytes taken by the header, table and ids */
+    size_t indexSize = 0;
+};
+
+/**
+ * @returns whether |prefix|, the first bytes of an image, starts a flat image
+ */
+bool isFlatImage(std::string_view prefix);
+
+/**
+ * Reads the index of the flat image at the start of |file|
+ * @returns the index, unset if it isn't a valid flat image
+ * @throws std::system_error if the file can't be read
+ */
+std::optional<Index> readIndex(const SysFile& file);
+
+/**
+ * @returns the position of the first payload of an image with these ids
+ */
+size_t payloadStart(size_t baseIdSize, size_t count, size_t idsSize);
+
+/**
+ * Places the payloads of |blobs|, sorted by id with their |length| set.
+ * Payloads keep their previous place if it still holds them, others go
+ * after the last payload. Everything is packed from scratch if the index
+ * grew into the payloads or if the image would exceed |maxSize|.
+ * @returns the size of the image
+ */
+size_t place(std::string_view baseId, std::vector<Extent>& blobs,
+             size_t maxSize);
+
+/**
+ * Encodes the header, table and ids of a flat image of |blobs| as placed by
+ * place(), zero padded up to the first payload
+ */
+std::string encodeIndex(std::string_view baseId,
+                        const std::vector<Extent>& blobs, size_t imageSize);
+
+/**
+ * Encodes a flat image of |blobs| as placed by place()
+ * @param payload: returns the payload of blobs[i]
+ */
+std::string encode(std::string_view baseId, const std::vector<Extent>& blobs,
+                   size_t imageSize,
+                   const std::function<std::span<const uint8_t>(size_t)>&
+                       payload);
+
+} // namespace binstore::flat
@@ -2,12 +2,15 @@
 
 #include "binarystore.hpp"
 
+#include <array>
 #include <blobs-ipmid/blobs.hpp>
 #include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 
 using std::size_t;
@@ -30,6 +33,13 @@ class BinaryStoreBlobHandler : public GenericBlobInterface
     BinaryStoreBlobHandler& operator=(BinaryStoreBlobHandler&&) = default;
 
     bool canHandleBlob(const std::string& path) override;
+
+    /**
+     * Returns the blob ids of all stores. The list is rebuilt from the stores
+     * only after one of them changes its ids; otherwise it is served from a
+     * cache. The interface returns by value, so each call still copies the
+     * whole list and a full Enumerate walk remains quadratic in copies.
+     */
     std::vector<std::string> getBlobIds() override;
     bool deleteBlob(const std::string& path) override;
     bool stat(const std::string& path, struct BlobMeta* meta) override;
@@ -56,13 +66,80 @@ class BinaryStoreBlobHandler : public GenericBlobInterface
     void addNewBinaryStore(
         std::unique_ptr<binstore::BinaryStoreInterface> store);
 
+    /**
+     * Renames the base id of a registered binarystore. A store renamed
+     * directly is found again by its new id on the next lookup that misses,
+     * at the cost of asking every store for its base id once.
+     *
+     * @param baseId: current base id of the store.
+     * @param newBaseId: base id to rename it to, not used by another store.
+     * @returns: true if the store was renamed.
+     */
+    bool setBaseBlobId(const std::string& baseId, const std::string& newBaseId);
+
   private:
-    /* map of baseId: binaryStore, which has a 1:1 relationship. */
-    std::map<std::string, std::unique_ptr<binstore::BinaryStoreInterface>>
+    /**
+     * @returns: the store whose base id is |base|, nullptr if none. Checks
+     *           the store found against its key and re-keys the stores when
+     *           they disagree or nothing is found.
+     */
+    binstore::BinaryStoreInterface* findStore(std::string_view base);
+
+    /* Key every store by its current base id */
+    void rekeyStores();
+
+    /* map of baseId: binaryStore, which has a 1:1 relationship. Lookups take
+     * a view of the base id within the blob id, and only ask the store found
+     * for its base id unless it was renamed behind the handler's back. */
+    std::map<std::string, std::unique_ptr<binstore::BinaryStoreInterface>,
+             std::less<>>
         stores_;
 
-    /* map of sessionId: open binaryStore pointer. */
-    std::unordered_map<uint16_t, binstore::BinaryStoreInterface*> sessions_;
+    /* Blob ids of all stores as last enumerated, valid while the sum of the
+     * stores' id generations is |blobIdsStamp_|. Reset when stores are added
+     * or renamed. */
+    std::vector<std::string> blobIds_;
+    std::optional<uint64_t> blobIdsStamp_;
+
+    /* Store of each open session, indexed directly by session id. The 16-bit
+     * session space is split into pages of 256 entries allocated on first
+     * use, so a lookup is two array reads without hashing. */
+    class SessionTable
+    {
+      public:
+        /* @returns the store of |session|, nullptr if it isn't open */
+        binstore::BinaryStoreInterface* find(uint16_t session) const
+        {
+            const auto& page = pages_[session >> 8];
+            return page ? (*page)[session & 0xff] : nullptr;
+        }
+
+        void insert(uint16_t session, binstore::BinaryStoreInterface* store)
+        {
+            auto& page = pages_[session >> 8];
+            if (!page)
+            {
+                page = std::make_unique<Page>();
+            }
+            (*page)[session & 0xff] = store;
+        }
+
+        void erase(uint16_t session)
+        {
+            if (auto& page = pages_[session >> 8])
+            {
+                (*page)[session & 0xff] = nullptr;
+            }
+        }
+
+      private:
+        using Page = std::array<binstore::BinaryStoreInterface*, 256>;
+        std::array<std::unique_ptr<Page>, 256> pages_;
+    };
+
+    /* sessionId: open binaryStore pointer. Several sessions may share a
+     * store, which keeps the per-session state itself. */
+    SessionTable sessions_;
 };
 
 } // namespace blobs
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "binarystore.hpp"
+#include "binarystore_interface.hpp"
+#include "sys_file.hpp"
+
+#include <blobs-ipmid/blobs.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace binstore
+{
+
+struct LogHeader;
+
+/**
+ * @class LogBinaryStore persists a store as an append-only log of per-blob
+ *     update records instead of a single image. A commit appends the records
+ *     of the changes made since the previous commit, so its cost follows the
+ *     size of the changes rather than the size of the store. Loading replays
+ *     the log. Once the records appended since the last compaction pass a
+ *     threshold, the log is compacted into a fresh base holding one record per
+ *     blob, under a new epoch that invalidates every older record. The new
+ *     base is written where it doesn't overlap the current one or its log,
+ *     then one of two headers is switched to it, so an interrupted compaction
+ *     leaves the previous base and log to load.
+ */
+class LogBinaryStore : public BinaryStoreInterface
+{
+  public:
+    using CommitState = BinaryStore::CommitState;
+
+    LogBinaryStore() = delete;
+    LogBinaryStore(const std::string& baseBlobId, std::unique_ptr<SysFile> file,
+                   std::optional<uint32_t> maxSize = std::nullopt,
+                   const StoreOptions& options = {});
+
+    ~LogBinaryStore() = default;
+
+    LogBinaryStore(const LogBinaryStore&) = delete;
+    LogBinaryStore& operator=(const LogBinaryStore&) = delete;
+    LogBinaryStore(LogBinaryStore&&) = default;
+    LogBinaryStore& operator=(LogBinaryStore&&) = default;
+
+    std::string getBaseBlobId() const override;
+    bool setBaseBlobId(const std::string& baseBlobId) override;
+    std::vector<std::string> getBlobIds() const override;
+    uint64_t getBlobIdsGeneration() const override;
+    bool openOrCreateBlob(uint16_t session, const std::string& blobId,
+                          uint16_t flags) override;
+    bool deleteBlob(const std::string& blobId) override;
+    std::span<const uint8_t> readView(uint16_t session, uint32_t offset,
+                                      uint32_t requestedSize) override;
+    std::vector<uint8_t> readBlob(const std::string& blobId) const override;
+    std::span<const uint8_t> readBlobView(const std::string& blobId) override;
+    using BinaryStoreInterface::write;
+    bool write(uint16_t session, uint32_t offset,
+               std::span<const uint8_t> data) override;
+    bool commit(uint16_t session) override;
+    bool close(uint16_t session) override;
+    bool stat(blobs::BlobMeta* meta) override;
+    bool statBlob(const std::string& blobId, blobs::BlobMeta* meta) override;
+    bool stat(uint16_t session, blobs::BlobMeta* meta) override;
+
+    /**
+     * @returns counters of the data written to the sysfile by commits.
+     */
+    const CommitStats& getCommitStats() const;
+
+    /**
+     * Helper factory method to create a LogBinaryStore instance
+     * @param baseBlobId: base id for the created instance
+     * @param sysFile: system file object for storing the log
+     * @param maxSize: optional limit of the space the log may use
+     * @param options: optional persistence behavior of the store, of which
+     *     only the log compaction threshold applies
+     * @returns unique_ptr to constructed LogBinaryStore. Caller should take
+     *     ownership of the instance.
+     */
+    static std::unique_ptr<BinaryStoreInterface> createFromConfig(
+        const std::string& baseBlobId, std::unique_ptr<SysFile> file,
+        std::optional<uint32_t> maxSize = std::nullopt,
+        const StoreOptions& options = {});
+
+  private:
+    /* Replay the log from sysfile if commit state is dirty.
+     * Returns False if encountered error when loading */
+    bool loadLog();
+
+    /* Replay the base and log |header| points to. Returns False if the base
+     * isn't intact.
+     * @throws std::system_error if the sysfile can't be read */
+    bool replay(const LogHeader& header,
+                std::optional<std::string>& loadedBaseId);
+
+    /* Queue the record of a change to be appended on the next commit */
+    void appendRecord(uint8_t type, const std::string& id, uint32_t offset,
+                      std::span<const uint8_t> data);
+
+    /* Append the pending records to the log, or compact it if it grew past
+     * the threshold or if |compaction| is set. */
+    bool persist(bool compaction);
+
+    /* Write a fresh base holding the current blobs next to the current one,
+     * then switch the older header to it.
+     * @throws std::system_error if the sysfile can't be written, or
+     *     std::runtime_error if there is no room for the base */
+    void compact();
+
+    /* Recompute |compactSize_| from scratch */
+    void recalcCompactSize();
+
+    /* Largest base that can be written, which leaves room for the next one
+     * in the max size */
+    size_t maxBaseSize() const;
+
+    /* Blob state flags of the store, without the open flags of a session */
+    uint16_t commitStateFlags() const;
+
+    /* The part of |blobId| following the base id, which keys |blobs_|.
+     * Unset if |blobId| doesn't start with the base id. */
+    std::optional<std::string_view> relativeId(std::string_view blobId) const;
+
+    /* Blobs by their id relative to the base id, so renaming the base id
+     * leaves them alone. Records hold the full ids. */
+    std::map<std::string, std::vector<uint8_t>, std::less<>> blobs_;
+    std::string baseBlobId_;
+    /* Sessions with an open blob, by session id */
+    std::unordered_map<uint16_t, StoreSession> sessions_;
+    std::unique_ptr<SysFile> file_ = nullptr;
+    CommitState commitState_ = CommitState::Dirty;
+    std::optional<uint32_t> maxSize;
+    StoreOptions options_;
+    /* Epoch of the current base, records of other epochs are stale */
+    uint64_t epoch_ = 0;
+    /* Each record checksum continues the checksum of the previous record, so
+     * leftovers of an older log never replay. These are the checksums of the
+     * last record in the sysfile and of the last pending record. */
+    uint32_t logCrc_ = 0, pendingCrc_ = 0;
+    /* Sysfile positions where the current base starts and ends, and where
+     * its log ends */
+    size_t baseStart_ = 0, baseEnd_ = 0, logEnd_ = 0;
+    /* Size of the records of a base holding the current blobs */
+    size_t compactSize_ = 0;
+    /* Encoded records of the changes since the last commit */
+    std::string pendingLog_;
+    /* Bumped every time the set of blob ids changes */
+    uint64_t blobIdsGeneration_ = 0;
+    CommitStats commitStats_;
+};
+
+} // namespace binstore
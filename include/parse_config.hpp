@@ -1,8 +1,18 @@
 #pragma once
 
+#include "binarystore.hpp"
+#include "deferred_binarystore.hpp"
+#include "log_binarystore.hpp"
+#include "sys_file.hpp"
+
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <optional>
+#include <stdexcept>
 #include <string>
 
 using std::uint32_t;
@@ -11,26 +21,89 @@ using json = nlohmann::json;
 namespace conf
 {
 
+using binstore::Compression;
+using binstore::ImageFormat;
+
+/* How a binary store is persisted */
+enum class StoreEngine
+{
+    Image, // A single serialized image, rewritten on commit
+    Log,   // An append-only log of changes, compacted once in a while
+};
+
 struct BinaryBlobConfig
 {
-    std::string blobBaseId;                     // Required
-    std::string sysFilePath;                    // Required
-    std::optional<uint32_t> offsetBytes;        // Optional
-    std::optional<uint32_t> maxSizeBytes;       // Optional
-    std::optional<std::string> aliasBlobBaseId; // Optional
-    bool migrateToAlias = false;                // Optional
+    std::string blobBaseId;                              // Required
+    std::string sysFilePath;                             // Required
+    std::optional<uint32_t> offsetBytes;                 // Optional
+    std::optional<uint32_t> maxSizeBytes;                // Optional
+    std::optional<std::string> aliasBlobBaseId;          // Optional
+    bool migrateToAlias = false;                         // Optional
+    std::optional<uint32_t> deltaCommitGranularityBytes; // Optional
+    bool lazyLoad = false;                               // Optional
+    std::optional<uint32_t> slotSizeBytes;               // Optional
+    StoreEngine engine = StoreEngine::Image;             // Optional
+    std::optional<uint32_t> logCompactionThresholdBytes; // Optional
+    bool asyncCommit = false;                            // Optional
+    std::optional<uint32_t> writeBackDelayMs;            // Optional
+    std::optional<uint32_t> writeBackDirtyBytes;         // Optional
+    Compression compression = Compression::None;         // Optional
+    ImageFormat format = ImageFormat::Proto;             // Optional
+    bool deferredLoad = false;                           // Optional
+    bool checksums = false;                              // Optional
+};
+
+/* Settings the log engine has no use for */
+static constexpr std::array imageEngineKeys = {
+    "aliasBlobBaseId",  "migrateToAlias",      "deltaCommitGranularityBytes",
+    "lazyLoad",         "slotSizeBytes",       "asyncCommit",
+    "writeBackDelayMs", "writeBackDirtyBytes", "compression",
+    "format",           "checksums",
 };
 
 /**
  * @brief Parse parameters from a config json
  * @param j: input json object
  * @param config: output BinaryBlobConfig
- * @throws: exception if config doesn't have required fields
+ * @throws: exception if config doesn't have required fields, or
+ *     std::invalid_argument if it has settings its engine doesn't support
  */
 static inline void parseFromConfigFile(const json& j, BinaryBlobConfig& config)
 {
     j.at("blobBaseId").get_to(config.blobBaseId);
     j.at("sysFilePath").get_to(config.sysFilePath);
+    if (j.contains("engine"))
+    {
+        const std::string engine = j.at("engine");
+        if (engine == "image")
+        {
+            config.engine = StoreEngine::Image;
+        }
+        else if (engine == "log")
+        {
+            config.engine = StoreEngine::Log;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown store engine " + engine);
+        }
+    }
+
+    /* The log engine would quietly ignore them, keeping the old id of a
+     * store asked to migrate to its alias for one */
+    if (config.engine == StoreEngine::Log)
+    {
+        for (const auto* key : imageEngineKeys)
+        {
+            if (j.contains(key))
+            {
+                throw std::invalid_argument(std::string(key) +
+                                            " isn't supported by the log "
+                                            "engine");
+            }
+        }
+    }
+
     if (j.contains("offsetBytes"))
     {
         j.at("offsetBytes").get_to(config.offsetBytes.emplace());
@@ -50,6 +123,155 @@ static inline void parseFromConfigFile(const json& j, BinaryBlobConfig& config)
     {
         config.migrateToAlias = j.at("migrateToAlias");
     }
+
+    if (j.contains("deltaCommitGranularityBytes"))
+    {
+        j.at("deltaCommitGranularityBytes")
+            .get_to(config.deltaCommitGranularityBytes.emplace());
+    }
+
+    if (j.contains("lazyLoad"))
+    {
+        config.lazyLoad = j.at("lazyLoad");
+    }
+
+    if (j.contains("slotSizeBytes"))
+    {
+        j.at("slotSizeBytes").get_to(config.slotSizeBytes.emplace());
+    }
+
+    if (j.contains("logCompactionThresholdBytes"))
+    {
+        j.at("logCompactionThresholdBytes")
+            .get_to(config.logCompactionThresholdBytes.emplace());
+    }
+
+    if (j.contains("asyncCommit"))
+    {
+        config.asyncCommit = j.at("asyncCommit");
+    }
+
+    if (j.contains("writeBackDelayMs"))
+    {
+        j.at("writeBackDelayMs").get_to(config.writeBackDelayMs.emplace());
+    }
+
+    if (j.contains("writeBackDirtyBytes"))
+    {
+        j.at("writeBackDirtyBytes")
+            .get_to(config.writeBackDirtyBytes.emplace());
+    }
+
+    if (j.contains("compression"))
+    {
+        const std::string compression = j.at("compression");
+        if (compression == "none")
+        {
+            config.compression = Compression::None;
+        }
+        else if (compression == "lz4")
+        {
+            config.compression = Compression::Lz4;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown compression " + compression);
+        }
+    }
+
+    if (j.contains("format"))
+    {
+        const std::string format = j.at("format");
+        if (format == "proto")
+        {
+            config.format = ImageFormat::Proto;
+        }
+        else if (format == "flat")
+        {
+            config.format = ImageFormat::Flat;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown image format " + format);
+        }
+    }
+
+    if (j.contains("checksums"))
+    {
+        config.checksums = j.at("checksums");
+    }
+
+    if (j.contains("deferredLoad"))
+    {
+        config.deferredLoad = j.at("deferredLoad");
+    }
+}
+
+/**
+ * @brief Collect the persistence options of a binary store from its config
+ * @param config: parsed BinaryBlobConfig
+ * @returns StoreOptions to construct the store with
+ */
+static inline binstore::StoreOptions
+    getStoreOptions(const BinaryBlobConfig& config)
+{
+    binstore::StoreOptions options;
+    options.deltaCommitGranularity = config.deltaCommitGranularityBytes;
+    options.lazyLoad = config.lazyLoad;
+    options.slotSize = config.slotSizeBytes;
+    options.logCompactionThreshold = config.logCompactionThresholdBytes;
+    options.asyncCommit = config.asyncCommit;
+    if (config.writeBackDelayMs)
+    {
+        options.writeBackDelay =
+            std::chrono::milliseconds(*config.writeBackDelayMs);
+    }
+    options.writeBackDirtyBytes = config.writeBackDirtyBytes;
+    options.compression = config.compression;
+    options.format = config.format;
+    options.checksums = config.checksums;
+    return options;
+}
+
+/**
+ * @brief Create the binary store described by a config with its engine
+ * @param config: parsed BinaryBlobConfig
+ * @param file: sysfile backing the store
+ * @returns the loaded store, nullptr if it can't be created
+ */
+static inline std::unique_ptr<binstore::BinaryStoreInterface>
+    createStore(const BinaryBlobConfig& config,
+                std::unique_ptr<binstore::SysFile> file)
+{
+    if (config.engine == StoreEngine::Log)
+    {
+        return binstore::LogBinaryStore::createFromConfig(
+            config.blobBaseId, std::move(file), config.maxSizeBytes,
+            getStoreOptions(config));
+    }
+    return binstore::BinaryStore::createFromConfig(
+        config.blobBaseId, std::move(file), config.maxSizeBytes,
+        config.aliasBlobBaseId, getStoreOptions(config));
+}
+
+/**
+ * @brief Create the binary store described by a config, opening and loading
+ *        it on a background thread if the config defers loading
+ * @param config: parsed BinaryBlobConfig
+ * @param openFile: opens the sysfile backing the store
+ * @returns the store, nullptr if it can't be created
+ */
+static inline std::unique_ptr<binstore::BinaryStoreInterface> createStore(
+    const BinaryBlobConfig& config,
+    const std::function<std::unique_ptr<binstore::SysFile>()>& openFile)
+{
+    if (!config.deferredLoad)
+    {
+        return createStore(config, openFile());
+    }
+    return binstore::DeferredBinaryStore::createInBackground(
+        config.blobBaseId,
+        [config, openFile] { return createStore(config, openFile()); });
 }
 
 } // namespace conf
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "sys_file.hpp"
+
+#include <string>
+
+namespace binstore
+{
+
+/**
+ * @brief A window into part of another sysfile. Positions are relative to the
+ *     start of the window and nothing outside of it can be accessed.
+ */
+class SysFileView : public SysFile
+{
+  public:
+    /**
+     * @brief Constructs a view of another sysfile
+     * @param file The sysfile to view, which must outlive the view
+     * @param offset Position in 'file' of the start of the view
+     * @param size Size of the view in bytes
+     */
+    SysFileView(SysFile& file, size_t offset, size_t size);
+    SysFileView() = delete;
+    SysFileView(const SysFileView&) = delete;
+    SysFileView& operator=(SysFileView) = delete;
+
+    size_t readToBuf(size_t pos, size_t count, char* buf) const override;
+    std::string readAsStr(size_t pos, size_t count) const override;
+    std::string readRemainingAsStr(size_t pos) const override;
+    void writeStr(const std::string& data, size_t pos) override;
+
+  private:
+    /* Number of bytes that can be accessed from 'pos' */
+    size_t available(size_t pos, size_t count) const;
+
+    SysFile& file_;
+    size_t offset_;
+    size_t size_;
+};
+
+} // namespace binstore
@@ -1,6 +1,9 @@
 #include "binarystore.hpp"
 
+#include "crc32c.hpp"
+#include "flat_image.hpp"
 #include "sys_file.hpp"
+#include "sys_file_view.hpp"
 
 #include <pb_decode.h>
 #include <pb_encode.h>
@@ -8,20 +11,33 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <array>
 #include <blobs-ipmid/blobs.hpp>
 #include <boost/endian/arithmetic.hpp>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
 #include <ipmid/handler.hpp>
-#include <map>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <phosphor-logging/elog.hpp>
+#include <span>
 #include <stdplus/str/cat.hpp>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "binaryblob.pb.n.h"
 
+#ifdef ENABLE_LZ4
+#include <lz4.h>
+#endif
+
 using std::size_t;
 using std::uint16_t;
 using std::uint32_t;
@@ -33,19 +49,185 @@ namespace binstore
 
 using namespace phosphor::logging;
 
+/* Header at the start of each slot in A/B mode. The image follows it. */
+struct SlotHeader
+{
+    boost::endian::little_uint32_t magic;
+    /* CRC32C of the fields below */
+    boost::endian::little_uint32_t headerCrc;
+    boost::endian::little_uint64_t sequence;
+    /* Size and CRC32C of the image past its length prefix. The CRC32C of a
+     * flat image covers its index, then its payloads in table order. */
+    boost::endian::little_uint64_t protoSize;
+    boost::endian::little_uint32_t protoCrc;
+};
+
+static constexpr uint32_t slotMagic = 0x42415342; // "BSAB" on disk
+
+static uint32_t slotHeaderCrc(const SlotHeader& header)
+{
+    constexpr size_t start = offsetof(SlotHeader, sequence);
+    return crc32c({reinterpret_cast<const uint8_t*>(&header) + start,
+                   sizeof(header) - start});
+}
+
+/* Read the header of the slot at |pos|, unset if it isn't valid */
+static std::optional<SlotHeader> readSlotHeader(const SysFile& file, size_t pos)
+{
+    SlotHeader header;
+    if (file.readToBuf(pos, sizeof(header), reinterpret_cast<char*>(&header)) !=
+            sizeof(header) ||
+        header.magic != slotMagic || header.headerCrc != slotHeaderCrc(header))
+    {
+        return std::nullopt;
+    }
+    return header;
+}
+
+/* Size of the buffer used to stream a commit to the sysfile, or to stream
+ * an image from it */
+static constexpr size_t commitChunkSize = 4096;
+
+/* CRC32C of |crc|'s data followed by the |count| bytes of |file| at |pos|,
+ * read in chunks. Unset if the sysfile ends before. */
+static std::optional<uint32_t> streamCrc(const SysFile& file, size_t pos,
+                                         size_t count, uint32_t crc = 0)
+{
+    while (count > 0)
+    {
+        auto chunk = file.readAsStr(pos, std::min(count, commitChunkSize));
+        if (chunk.empty())
+        {
+            return std::nullopt;
+        }
+        crc = crc32c(chunk, crc);
+        pos += chunk.size();
+        count -= chunk.size();
+    }
+    return crc;
+}
+
+static bool validOptions(const StoreOptions& options)
+{
+    if (options.slotSize && *options.slotSize <= sizeof(SlotHeader))
+    {
+        log<level::ERR>("Slot size too small to hold an image",
+                        entry("SLOT_SIZE=%u", *options.slotSize));
+        return false;
+    }
+#ifndef ENABLE_LZ4
+    if (options.compression == Compression::Lz4)
+    {
+        log<level::ERR>("LZ4 compression is not supported by this build");
+        return false;
+    }
+#endif
+    return true;
+}
+
+/* Flag in the length prefix of an image whose proto is LZ4 compressed. The
+ * compressed proto is preceded by its little endian uint32 size. */
+static constexpr uint64_t compressedImageFlag = uint64_t{1} << 63;
+
+/* LZ4 never expands data by more than this */
+static constexpr size_t lz4MaxRatio = 255;
+
+/* Compress the proto of the length-prefixed |image|.
+ * @throws std::runtime_error if it can't be compressed */
+static std::string compressImage(std::string_view image)
+{
+#ifdef ENABLE_LZ4
+    using boost::endian::little_uint32_t;
+    using boost::endian::little_uint64_t;
+    const auto proto = image.substr(sizeof(little_uint64_t));
+    if (proto.size() > LZ4_MAX_INPUT_SIZE)
+    {
+        throw std::runtime_error("Image too large to compress");
+    }
+
+    constexpr size_t headerSize = sizeof(little_uint64_t) +
+                                  sizeof(little_uint32_t);
+    std::string out(headerSize + LZ4_compressBound(proto.size()), '\0');
+    int compressed = LZ4_compress_default(
+        proto.data(), out.data() + headerSize, proto.size(),
+        out.size() - headerSize);
+    if (compressed <= 0)
+    {
+        throw std::runtime_error("LZ4 compression failed");
+    }
+    out.resize(headerSize + compressed);
+
+    const little_uint64_t prefix = compressedImageFlag |
+                                   (sizeof(little_uint32_t) + compressed);
+    const little_uint32_t protoSize = proto.size();
+    std::copy_n(reinterpret_cast<const char*>(&prefix), sizeof(prefix),
+                out.data());
+    std::copy_n(reinterpret_cast<const char*>(&protoSize), sizeof(protoSize),
+                out.data() + sizeof(prefix));
+    return out;
+#else
+    static_cast<void>(image);
+    throw std::runtime_error("LZ4 compression is not supported by this build");
+#endif
+}
+
+/* Decompress |stored|, what follows the length prefix of a compressed image.
+ * @throws std::runtime_error if it isn't valid */
+static std::string decompressProto(std::string_view stored)
+{
+#ifdef ENABLE_LZ4
+    boost::endian::little_uint32_t protoSize;
+    if (stored.size() < sizeof(protoSize) ||
+        stored.size() - sizeof(protoSize) > LZ4_MAX_INPUT_SIZE)
+    {
+        throw std::runtime_error("Invalid compressed image size");
+    }
+    std::copy_n(stored.data(), sizeof(protoSize),
+                reinterpret_cast<char*>(&protoSize));
+    const auto compressed = stored.substr(sizeof(protoSize));
+    /* Don't trust a size that the compressed data can't expand to */
+    if (protoSize > compressed.size() * lz4MaxRatio)
+    {
+        throw std::runtime_error("Invalid decompressed image size");
+    }
+
+    std::string proto(protoSize, '\0');
+    if (LZ4_decompress_safe(compressed.data(), proto.data(), compressed.size(),
+                            proto.size()) != static_cast<int>(proto.size()))
+    {
+        throw std::runtime_error("Compressed image is corrupted");
+    }
+    return proto;
+#else
+    static_cast<void>(stored);
+    throw std::runtime_error("LZ4 compression is not supported by this build");
+#endif
+}
+
+BinaryStore::~BinaryStore()
+{
+    /* A moved-from store has nothing left to write */
+    if (file_)
+    {
+        flushWriteBack(true);
+        finishAsyncCommit(true);
+    }
+}
+
 std::unique_ptr<BinaryStoreInterface> BinaryStore::createFromConfig(
     const std::string& baseBlobId, std::unique_ptr<SysFile> file,
-    std::optional<uint32_t> maxSize, std::optional<std::string> aliasBlobBaseId)
+    std::optional<uint32_t> maxSize, std::optional<std::string> aliasBlobBaseId,
+    const StoreOptions& options)
 {
-    if (baseBlobId.empty() || !file)
+    if (baseBlobId.empty() || !file || !validOptions(options))
     {
         log<level::ERR>("Unable to create binarystore from invalid config",
                         entry("BASE_ID=%s", baseBlobId.c_str()));
         return nullptr;
     }
 
-    auto store =
-        std::make_unique<BinaryStore>(baseBlobId, std::move(file), maxSize);
+    auto store = std::make_unique<BinaryStore>(baseBlobId, std::move(file),
+                                               maxSize, options);
 
     if (!store->loadSerializedData(aliasBlobBaseId))
     {
@@ -57,16 +239,17 @@ std::unique_ptr<BinaryStoreInterface> BinaryStore::createFromConfig(
 
 std::unique_ptr<BinaryStoreInterface>
     BinaryStore::createFromFile(std::unique_ptr<SysFile> file, bool readOnly,
-                                std::optional<uint32_t> maxSize)
+                                std::optional<uint32_t> maxSize,
+                                const StoreOptions& options)
 {
-    if (!file)
+    if (!file || !validOptions(options))
     {
         log<level::ERR>("Unable to create binarystore from invalid file");
         return nullptr;
     }
 
-    auto store =
-        std::make_unique<BinaryStore>(std::move(file), readOnly, maxSize);
+    auto store = std::make_unique<BinaryStore>(std::move(file), readOnly,
+                                               maxSize, options);
 
     if (!store->loadSerializedData())
     {
@@ -76,6 +259,38 @@ std::unique_ptr<BinaryStoreInterface>
     return store;
 }
 
+/* Number of bytes used by |value| once varint encoded */
+static constexpr std::size_t varintSize(std::uint64_t value) noexcept
+{
+    std::size_t size = 1;
+    while (value >>= 7)
+    {
+        ++size;
+    }
+    return size;
+}
+
+/* Encoded size of a length-delimited field of |len| bytes. All fields in
+ * binaryblob.proto have a field number below 16, so the tag is one byte. */
+static constexpr std::size_t lenFieldSize(std::size_t len) noexcept
+{
+    return 1 + varintSize(len) + len;
+}
+
+/* Encoded size of the fixed32 crc field of a BinaryBlob */
+static constexpr std::size_t crcFieldSize = 1 + sizeof(uint32_t);
+
+/* Encoded size of a single BinaryBlob entry in BinaryBlobBase.blobs. The id
+ * and data are always emitted by the encoder, even when empty, and the crc
+ * only if checksums are enabled. */
+static constexpr std::size_t blobEntrySize(std::size_t idSize,
+                                           std::size_t dataSize,
+                                           bool checksum) noexcept
+{
+    return lenFieldSize(lenFieldSize(idSize) + lenFieldSize(dataSize) +
+                        (checksum ? crcFieldSize : 0));
+}
+
 template <typename S>
 static constexpr auto pbDecodeStr = [](pb_istream_t* stream,
                                        const pb_field_iter_t*,
@@ -92,6 +307,101 @@ static pb_callback_t pbStrDecoder(T& t) noexcept
     return {{.decode = pbDecodeStr<T>}, &t};
 }
 
+/* Common state of the input streams below. Tracks the position of the next
+ * byte to decode so that payloads can be skipped and referenced later. */
+struct StreamPosition
+{
+    size_t pos;
+};
+
+/* State of a nanopb input stream reading directly from a SysFile. Reads go
+ * through a small buffer so decoding tags and lengths stays cheap, while large
+ * fields can be skipped without reading them. */
+struct SysFileStream : StreamPosition
+{
+    const SysFile* file;
+    std::array<char, 256> buf = {};
+    size_t bufPos = 0, bufLen = 0;
+    /* Exception thrown by the SysFile, nanopb can't propagate it */
+    std::exception_ptr error = nullptr;
+};
+
+static bool sysFileStreamRead(pb_istream_t* stream, pb_byte_t* buf,
+                              size_t count) noexcept
+{
+    auto& s = static_cast<SysFileStream&>(
+        *reinterpret_cast<StreamPosition*>(stream->state));
+    while (count > 0)
+    {
+        if (s.pos < s.bufPos || s.pos >= s.bufPos + s.bufLen)
+        {
+            try
+            {
+                s.bufLen = s.file->readToBuf(s.pos, s.buf.size(),
+                                             s.buf.data());
+            }
+            catch (...)
+            {
+                s.error = std::current_exception();
+                return false;
+            }
+            s.bufPos = s.pos;
+            if (s.bufLen == 0)
+            {
+                return false;
+            }
+        }
+        size_t n = std::min(count, s.bufPos + s.bufLen - s.pos);
+        std::copy_n(s.buf.data() + (s.pos - s.bufPos), n,
+                    reinterpret_cast<char*>(buf));
+        buf += n;
+        s.pos += n;
+        count -= n;
+    }
+    return true;
+}
+
+/* State of a nanopb input stream reading from an in-memory copy of the proto */
+struct ArenaStream : StreamPosition
+{
+    const std::string* arena;
+};
+
+static bool arenaStreamRead(pb_istream_t* stream, pb_byte_t* buf,
+                            size_t count) noexcept
+{
+    auto& s = static_cast<ArenaStream&>(
+        *reinterpret_cast<StreamPosition*>(stream->state));
+    if (count > s.arena->size() - s.pos)
+    {
+        return false;
+    }
+    std::copy_n(s.arena->data() + s.pos, count, reinterpret_cast<char*>(buf));
+    s.pos += count;
+    return true;
+}
+
+/* Records where a payload is located in the stream and skips over it without
+ * copying it. Only usable with the StreamPosition based streams above. */
+template <typename B>
+static constexpr auto pbSkipPayload = [](pb_istream_t* stream,
+                                         const pb_field_iter_t*,
+                                         void** arg) noexcept {
+    auto& s = *reinterpret_cast<StreamPosition*>(stream->state);
+    auto& blob = *reinterpret_cast<B*>(*arg);
+    blob.offset = s.pos;
+    blob.storedSize = stream->bytes_left;
+    s.pos += stream->bytes_left;
+    stream->bytes_left = 0;
+    return true;
+};
+
+template <typename B>
+static pb_callback_t pbPayloadSkipper(B& b) noexcept
+{
+    return {{.decode = pbSkipPayload<B>}, &b};
+}
+
 template <typename S>
 static constexpr auto pbEncodeStr = [](pb_ostream_t* stream,
                                        const pb_field_iter_t* field,
@@ -109,370 +419,1788 @@ static pb_callback_t pbStrEncoder(const T& t) noexcept
     return {{.encode = pbEncodeStr<T>}, const_cast<T*>(&t)};
 }
 
-bool BinaryStore::loadSerializedData(std::optional<std::string> aliasBlobBaseId)
+/* A blob id kept as the base id and the part of the id following it */
+struct SplitId
 {
-    /* Load blob from sysfile if we know it might not match what we have.
-     * Note it will overwrite existing unsaved data per design. */
-    if (commitState_ == CommitState::Clean ||
-        commitState_ == CommitState::Uninitialized)
-    {
-        return true;
-    }
+    std::string_view base;
+    std::string_view rest;
+};
 
-    std::string protoBlobId;
+static constexpr auto pbEncodeSplitId = [](pb_ostream_t* stream,
+                                           const pb_field_iter_t* field,
+                                           void* const* arg) noexcept {
+    const auto& id = *reinterpret_cast<const SplitId*>(*arg);
+    return pb_encode_tag_for_field(stream, field) &&
+           pb_encode_varint(stream, id.base.size() + id.rest.size()) &&
+           pb_write(stream, reinterpret_cast<const pb_byte_t*>(id.base.data()),
+                    id.base.size()) &&
+           pb_write(stream, reinterpret_cast<const pb_byte_t*>(id.rest.data()),
+                    id.rest.size());
+};
+
+static pb_callback_t pbSplitIdEncoder(const SplitId& id) noexcept
+{
+    return {{.encode = pbEncodeSplitId}, const_cast<SplitId*>(&id)};
+}
+
+bool BinaryStore::decodeImage(std::string& protoBlobId)
+{
     static constexpr auto blobcb = [](pb_istream_t* stream,
                                       const pb_field_iter_t*,
                                       void** arg) noexcept {
         std::string id;
-        std::vector<std::uint8_t> data;
+        Blob blob;
         binstore_binaryblobproto_BinaryBlob msg = {
             .blob_id = pbStrDecoder(id),
-            .data = pbStrDecoder(data),
+            .data = pbPayloadSkipper(blob),
+            .has_crc = false,
+            .crc = 0,
         };
         if (!pb_decode(stream, binstore_binaryblobproto_BinaryBlob_fields,
                        &msg))
         {
             return false;
         }
+        if (msg.has_crc)
+        {
+            blob.crc = msg.crc;
+        }
         reinterpret_cast<decltype(std::declval<BinaryStore>().blobs_)*>(*arg)
-            ->emplace(id, data);
+            ->emplace(std::move(id), std::move(blob));
         return true;
     };
+    binstore_binaryblobproto_BinaryBlobBase msg = {
+        .blob_base_id = pbStrDecoder(protoBlobId),
+        .blobs = {{.decode = blobcb}, &blobs_},
+    };
 
+    protoBlobId.clear();
+    blobs_.clear(); // Purge old contents before new append during decode
+    persistedImage_.clear();
+    arena_.clear();
+    bool decoded = false;
     try
     {
         /* Parse length-prefixed format to protobuf */
         boost::endian::little_uint64_t size = 0;
-        file_->readToBuf(0, sizeof(size), reinterpret_cast<char*>(&size));
-        auto proto = file_->readAsStr(sizeof(size), size);
-
-        auto ist = pb_istream_from_buffer(
-            reinterpret_cast<const pb_byte_t*>(proto.data()), proto.size());
-        binstore_binaryblobproto_BinaryBlobBase msg = {
-            .blob_base_id = pbStrDecoder(protoBlobId),
-            .blobs = {{.decode = blobcb}, &blobs_},
-        };
-        blobs_.clear(); // Purge old contents before new append during decode
-        if (!pb_decode(&ist, binstore_binaryblobproto_BinaryBlobBase_fields,
-                       &msg))
+        imageFile().readToBuf(0, sizeof(size), reinterpret_cast<char*>(&size));
+        imageFormat_ = flat::isFlatImage({reinterpret_cast<const char*>(&size),
+                                          sizeof(size)})
+                           ? ImageFormat::Flat
+                           : ImageFormat::Proto;
+        compressedImage_ = imageFormat_ == ImageFormat::Proto &&
+                           (size & compressedImageFlag);
+
+        if (imageFormat_ == ImageFormat::Flat)
         {
-            /* Fail to parse the data, which might mean no preexsiting blobs
-             * and is a valid case to handle. Simply init an empty binstore. */
-            commitState_ = CommitState::Uninitialized;
+            decoded = decodeFlatImage(protoBlobId);
+        }
+        else if (payloadsInSysfile())
+        {
+            /* Decode straight from the sysfile so payloads are never read */
+            SysFileStream fileStream;
+            fileStream.pos = sizeof(size);
+            fileStream.file = &imageFile();
+            pb_istream_t ist = {
+                .callback = sysFileStreamRead,
+                .state = static_cast<StreamPosition*>(&fileStream),
+                .bytes_left = size,
+                .errmsg = nullptr,
+            };
+            decoded = pb_decode(
+                &ist, binstore_binaryblobproto_BinaryBlobBase_fields, &msg);
+            if (!decoded && fileStream.error)
+            {
+                std::rethrow_exception(fileStream.error);
+            }
+        }
+        else
+        {
+            /* Payloads are left in the arena and only copied out once their
+             * blob gets written */
+            auto stored = imageFile().readAsStr(sizeof(size),
+                                                size & ~compressedImageFlag);
+            if (compressedImage_)
+            {
+                arena_ = decompressProto(stored);
+            }
+            else
+            {
+                arena_ = std::move(stored);
+            }
+
+            ArenaStream arenaStream;
+            arenaStream.pos = 0;
+            arenaStream.arena = &arena_;
+            pb_istream_t ist = {
+                .callback = arenaStreamRead,
+                .state = static_cast<StreamPosition*>(&arenaStream),
+                .bytes_left = arena_.size(),
+                .errmsg = nullptr,
+            };
+            decoded = pb_decode(
+                &ist, binstore_binaryblobproto_BinaryBlobBase_fields, &msg);
+            /* A corrupted payload only affects its blob. Payloads left in the
+             * sysfile in lazy mode are verified once they are read. */
+            for (auto& [id, blob] : blobs_)
+            {
+                if (decoded && !verifyChecksum(blob, blob.bytes(arena_)))
+                {
+                    log<level::ERR>("Blob payload failed its checksum",
+                                    entry("BLOB_ID=%s", id.c_str()));
+                }
+            }
+            if (decoded && options_.deltaCommitGranularity &&
+                !options_.slotSize)
+            {
+                persistedImage_.assign(reinterpret_cast<const char*>(&size),
+                                       sizeof(size));
+                persistedImage_ += compressedImage_ ? stored : arena_;
+            }
         }
     }
-    catch (const std::system_error& e)
+    catch (const std::system_error&)
     {
-        /* Read causes unexpected system-level failure */
-        log<level::ERR>("Reading from sysfile failed",
-                        entry("ERROR=%s", e.what()));
-        return false;
+        throw;
     }
-    catch (const std::exception& e)
+    catch (const std::exception&)
     {
         /* Non system error originates from junk value in 'size' */
-        commitState_ = CommitState::Uninitialized;
-    }
-
-    if (commitState_ == CommitState::Uninitialized)
-    {
-        log<level::WARNING>("Fail to parse. There might be no persisted blobs",
-                            entry("BASE_ID=%s", baseBlobId_.c_str()));
-        return true;
+        decoded = false;
     }
 
-    if (baseBlobId_.empty() && !protoBlobId.empty())
-    {
-        baseBlobId_ = std::move(protoBlobId);
-    }
-    else if (protoBlobId == aliasBlobBaseId)
+    if (!decoded)
     {
-        log<level::WARNING>("Alias blob id, rename blob id...",
-                            entry("LOADED=%s", protoBlobId.c_str()),
-                            entry("RENAMED=%s", baseBlobId_.c_str()));
-        std::string tmpBlobId = baseBlobId_;
-        baseBlobId_ = *aliasBlobBaseId;
-        return setBaseBlobId(tmpBlobId);
+        /* Drop whatever got decoded before the failure */
+        blobs_.clear();
+        arena_.clear();
     }
-    else if (protoBlobId != baseBlobId_ && !readOnly_)
+    else if (imageFormat_ == ImageFormat::Proto)
     {
-        /* Uh oh, stale data loaded. Clean it and commit. */
-        // TODO: it might be safer to add an option in config to error out
-        // instead of to overwrite.
-        log<level::ERR>("Stale blob data, resetting internals...",
-                        entry("LOADED=%s", protoBlobId.c_str()),
-                        entry("EXPECTED=%s", baseBlobId_.c_str()));
-        blobs_.clear();
-        return this->commit();
+        makeIdsRelative(protoBlobId);
     }
-
-    return true;
+    return decoded;
 }
 
-std::string BinaryStore::getBaseBlobId() const
-{
-    return baseBlobId_;
-}
-
-bool BinaryStore::setBaseBlobId(const std::string& baseBlobId)
+void BinaryStore::makeIdsRelative(std::string_view baseId)
 {
-    for (auto it = blobs_.begin(); it != blobs_.end();)
+    /* Removing a common prefix keeps the order */
+    auto blobs = blobs_.extract_sequence();
+    auto kept = blobs.begin();
+    for (auto& kv : blobs)
     {
-        auto curr = it++;
-        if (curr->first.starts_with(baseBlobId_))
+        if (!kv.first.starts_with(baseId))
         {
-            auto nh = blobs_.extract(curr);
-            nh.key() = stdplus::strCat(
-                baseBlobId,
-                std::string_view(curr->first).substr(baseBlobId_.size()));
-            blobs_.insert(std::move(nh));
+            log<level::WARNING>("Dropping blob outside of the base id",
+                                entry("BLOB_ID=%s", kv.first.c_str()));
+            continue;
         }
+        /* A fresh copy, so short ids fit in the string itself */
+        kv.first = kv.first.substr(baseId.size());
+        if (&*kept != &kv)
+        {
+            *kept = std::move(kv);
+        }
+        ++kept;
     }
-    baseBlobId_ = baseBlobId;
-    return this->commit();
-}
-
-std::vector<std::string> BinaryStore::getBlobIds() const
-{
-    std::vector<std::string> result;
-    result.reserve(blobs_.size() + 1);
-    result.emplace_back(getBaseBlobId());
-    for (const auto& kv : blobs_)
-    {
-        result.emplace_back(kv.first);
-    }
-    return result;
+    blobs.erase(kept, blobs.end());
+    blobs_.adopt_sequence(boost::container::ordered_unique_range,
+                          std::move(blobs));
 }
 
-bool BinaryStore::openOrCreateBlob(const std::string& blobId, uint16_t flags)
+bool BinaryStore::decodeFlatImage(std::string& protoBlobId)
 {
-    if (!(flags & blobs::OpenFlags::read))
+    auto index = flat::readIndex(imageFile());
+    if (!index)
     {
-        log<level::ERR>("OpenFlags::read not specified when opening",
-                        entry("BLOB_ID=%s", blobId.c_str()));
         return false;
     }
-
-    if (!currentBlob_.empty())
+    if (!payloadsInSysfile())
     {
-        log<level::ERR>("Already handling a different blob",
-                        entry("EXPECTED=%s", currentBlob_.c_str()),
-                        entry("RECEIVED=%s", blobId.c_str()));
-        return false;
+        /* Payloads are left in the arena, at their place in the image */
+        arena_ = imageFile().readAsStr(0, index->imageSize);
+        if (arena_.size() != index->imageSize)
+        {
+            return false;
+        }
     }
 
-    if (readOnly_ && (flags & blobs::OpenFlags::write))
+    protoBlobId = std::move(index->baseId);
+    blobs_.reserve(index->blobs.size());
+    for (auto& extent : index->blobs)
     {
-        log<level::ERR>("Can't open the blob for writing: read-only store",
-                        entry("BLOB_ID=%s", blobId.c_str()));
-        return false;
+        Blob blob;
+        blob.offset = extent.offset;
+        blob.storedSize = extent.length;
+        blob.crc = extent.crc;
+        blob.flatOffset = extent.offset;
+        blob.flatCapacity = extent.capacity;
+        if (!payloadsInSysfile() && !verifyChecksum(blob, blob.bytes(arena_)))
+        {
+            log<level::ERR>("Blob payload failed its checksum",
+                            entry("BLOB_ID=%s", extent.id.c_str()));
+        }
+        /* The table is sorted, so each blob goes at the end of the map */
+        blobs_.emplace_hint(blobs_.end(), std::move(extent.id),
+                            std::move(blob));
     }
 
-    writable_ = flags & blobs::OpenFlags::write;
-
-    /* If there are uncommitted data, discard them. */
-    if (!this->loadSerializedData())
+    /* Blobs keep their place across commits, so a commit only writes the
+     * payloads that changed and the blocks of the index that differ */
+    if (!options_.slotSize)
     {
-        return false;
+        const size_t start = flat::alignUp(index->indexSize);
+        persistedImage_ = payloadsInSysfile()
+                              ? imageFile().readAsStr(0, start)
+                              : arena_.substr(0, start);
     }
+    return true;
+}
 
-    /* Iterate and find if there is an existing blob with this id.
-     * blobsPtr points to a BinaryBlob container with STL-like semantics*/
-    if (blobs_.find(blobId) != blobs_.end())
+void BinaryStore::setupSlots()
+{
+    if (!options_.slotSize)
     {
-        currentBlob_ = blobId;
-        return true;
+        return;
     }
-
-    /* Otherwise, create the blob and append it */
-    if (readOnly_)
+    for (size_t i = 0; i < slots_.size(); ++i)
     {
-        return false;
+        slots_[i] = std::make_unique<SysFileView>(
+            *file_, i * *options_.slotSize + sizeof(SlotHeader),
+            *options_.slotSize - std::min<size_t>(*options_.slotSize,
+                                                  sizeof(SlotHeader)));
     }
-
-    blobs_.emplace(blobId, std::vector<std::uint8_t>{});
-    currentBlob_ = blobId;
-    commitState_ = CommitState::Dirty;
-    return true;
 }
 
-bool BinaryStore::deleteBlob(const std::string&)
+SysFile& BinaryStore::imageFile() const
 {
-    return false;
+    return options_.slotSize ? *slots_[activeSlot_] : *file_;
 }
 
-std::vector<uint8_t> BinaryStore::read(uint32_t offset, uint32_t requestedSize)
+bool BinaryStore::decodeNewestSlot(std::string& protoBlobId)
 {
-    if (currentBlob_.empty())
+    /* Only the two headers decide which image is current, newest first */
+    std::array<std::pair<size_t, std::optional<SlotHeader>>, 2> candidates;
+    for (size_t i = 0; i < candidates.size(); ++i)
     {
-        log<level::ERR>("No open blob to read");
-        return {};
+        candidates[i] = {i, readSlotHeader(*file_, i * *options_.slotSize)};
     }
+    std::ranges::sort(candidates, std::greater{}, [](const auto& c) {
+        return c.second ? static_cast<uint64_t>(c.second->sequence) + 1 : 0;
+    });
 
-    const auto& data = blobs_.find(currentBlob_)->second;
-
-    /* If it is out of bound, return empty vector */
-    if (offset >= data.size())
+    slotSequence_ = candidates[0].second
+                        ? static_cast<uint64_t>(candidates[0].second->sequence)
+                        : 0;
+    for (const auto& [slot, header] : candidates)
     {
-        log<level::ERR>("Read offset is beyond data size",
-                        entry("MAX_SIZE=0x%x", data.size()),
-                        entry("RECEIVED_OFFSET=0x%x", offset));
-        return {};
+        if (!header)
+        {
+            break;
+        }
+        activeSlot_ = slot;
+        if (!decodeImage(protoBlobId))
+        {
+            log<level::WARNING>("Slot image can't be decoded",
+                                entry("SLOT=%zu", slot));
+            continue;
+        }
+        if (slotImageIntact(header->protoSize, header->protoCrc))
+        {
+            return true;
+        }
+        log<level::WARNING>("Slot image doesn't match its checksum",
+                            entry("SLOT=%zu", slot));
     }
 
-    auto s = data.begin() + offset;
-    return {s, s + std::min<size_t>(requestedSize, data.size() - offset)};
+    /* Nothing usable, the next commit goes to the first slot */
+    blobs_.clear();
+    arena_.clear();
+    activeSlot_ = 1;
+    return false;
 }
 
-std::vector<uint8_t> BinaryStore::readBlob(const std::string& blobId) const
+bool BinaryStore::slotImageIntact(uint64_t protoSize, uint32_t protoCrc) const
 {
-    const auto blobIt = blobs_.find(blobId);
-    if (blobIt == blobs_.end())
+    /* A compressed image is only accepted if it decompresses to the exact
+     * size it records, and each blob has its own checksum */
+    if (compressedImage_)
     {
-        throw ipmi::HandlerCompletion(ipmi::ccUnspecifiedError);
+        return true;
     }
-    return blobIt->second;
-}
 
-static binstore_binaryblobproto_BinaryBlobBase makeEncoder(
-    const std::string& base,
-    const std::map<std::string, std::vector<std::uint8_t>>& blobs) noexcept
-{
-    using Blobs = std::decay_t<decltype(blobs)>;
-    static constexpr auto blobcb = [](pb_ostream_t* stream,
+    /* Past the length prefix, or the magic number of a flat image */
+    constexpr size_t start = sizeof(boost::endian::little_uint64_t);
+    if (imageFormat_ == ImageFormat::Proto)
+    {
+        /* Payloads left in the sysfile are only streamed through */
+        if (payloadsInSysfile())
+        {
+            return streamCrc(imageFile(), start, protoSize) == protoCrc;
+        }
+        return arena_.size() == protoSize && crc32c(arena_) == protoCrc;
+    }
+
+    /* The checksum of a flat image covers its index, then the payloads in
+     * table order, which leaves out the unused space between them */
+    auto index = flat::readIndex(imageFile());
+    if (!index || index->imageSize != start + protoSize)
+    {
+        return false;
+    }
+    auto crc = streamCrc(imageFile(), start,
+                         flat::alignUp(index->indexSize) - start);
+    for (auto it = blobs_.begin(); crc && it != blobs_.end(); ++it)
+    {
+        const auto& blob = it->second;
+        crc = payloadsInSysfile()
+                  ? streamCrc(imageFile(), *blob.offset, blob.storedSize, *crc)
+                  : crc32c(blob.bytes(arena_), *crc);
+    }
+    return crc == protoCrc;
+}
+
+bool BinaryStore::loadSerializedData(std::optional<std::string> aliasBlobBaseId)
+{
+    /* The sysfile isn't consistent until a pending commit is done, which
+     * might also leave nothing to reload */
+    flushWriteBack(true);
+    finishAsyncCommit(true);
+
+    /* Load blob from sysfile if we know it might not match what we have.
+     * Note it will overwrite existing unsaved data per design. */
+    if (commitState_ == CommitState::Clean ||
+        commitState_ == CommitState::Uninitialized)
+    {
+        return true;
+    }
+
+    /* Whatever gets decoded replaces the blobs */
+    ++blobIdsGeneration_;
+    std::string protoBlobId;
+    try
+    {
+        bool decoded = options_.slotSize ? decodeNewestSlot(protoBlobId)
+                                         : decodeImage(protoBlobId);
+        if (!decoded)
+        {
+            /* Fail to parse the data, which might mean no preexsiting blobs
+             * and is a valid case to handle. Simply init an empty binstore. */
+            commitState_ = CommitState::Uninitialized;
+        }
+        else if (protoBlobId.empty() && blobs_.empty())
+        {
+            /* Nothing stored whose format would be worth keeping */
+            imageFormat_ = options_.format;
+        }
+    }
+    catch (const std::system_error& e)
+    {
+        /* Read causes unexpected system-level failure */
+        log<level::ERR>("Reading from sysfile failed",
+                        entry("ERROR=%s", e.what()));
+        return false;
+    }
+
+    if (commitState_ == CommitState::Uninitialized)
+    {
+        log<level::WARNING>("Fail to parse. There might be no persisted blobs",
+                            entry("BASE_ID=%s", baseBlobId_.c_str()));
+        imageFormat_ = options_.format;
+        recalcEncodedSize();
+        /* The empty store is what reloading would produce again */
+        persistedGeneration_ = generation_;
+        return true;
+    }
+
+    /* In-memory data now matches the sysfile */
+    commitState_ = CommitState::Clean;
+    persistedGeneration_ = generation_;
+
+    if (baseBlobId_.empty() && !protoBlobId.empty())
+    {
+        baseBlobId_ = std::move(protoBlobId);
+    }
+    else if (protoBlobId == aliasBlobBaseId)
+    {
+        log<level::WARNING>("Alias blob id, rename blob id...",
+                            entry("LOADED=%s", protoBlobId.c_str()),
+                            entry("RENAMED=%s", baseBlobId_.c_str()));
+        std::string tmpBlobId = baseBlobId_;
+        baseBlobId_ = *aliasBlobBaseId;
+        return setBaseBlobId(tmpBlobId);
+    }
+    else if (protoBlobId != baseBlobId_ && readOnly_)
+    {
+        /* Blobs are keyed relative to the base id they were loaded with */
+        log<level::ERR>("Stale blob data, not loading it",
+                        entry("LOADED=%s", protoBlobId.c_str()),
+                        entry("EXPECTED=%s", baseBlobId_.c_str()));
+        blobs_.clear();
+    }
+    else if (protoBlobId != baseBlobId_)
+    {
+        /* Uh oh, stale data loaded. Clean it and commit. */
+        // TODO: it might be safer to add an option in config to error out
+        // instead of to overwrite.
+        log<level::ERR>("Stale blob data, resetting internals...",
+                        entry("LOADED=%s", protoBlobId.c_str()),
+                        entry("EXPECTED=%s", baseBlobId_.c_str()));
+        blobs_.clear();
+        recalcEncodedSize();
+        ++generation_;
+        return persist();
+    }
+
+    recalcEncodedSize();
+    return true;
+}
+
+void BinaryStore::recalcEncodedSize()
+{
+    if (imageFormat_ == ImageFormat::Flat)
+    {
+        /* Up to alignment - 1 bytes of padding follow the ids */
+        encodedSize_ = sizeof(flat::Header) + baseBlobId_.size() +
+                       flat::alignment - 1;
+    }
+    else
+    {
+        /* Proto is prepended with the size of the proto */
+        encodedSize_ = sizeof(boost::endian::little_uint64_t) +
+                       lenFieldSize(baseBlobId_.size());
+    }
+    for (const auto& [id, blob] : blobs_)
+    {
+        encodedSize_ += entrySize(id.size(), blob.size());
+    }
+}
+
+size_t BinaryStore::entrySize(size_t idSize, size_t dataSize) const
+{
+    if (imageFormat_ == ImageFormat::Flat)
+    {
+        return sizeof(flat::Entry) + idSize + flat::alignUp(dataSize);
+    }
+    /* The proto holds full ids */
+    return blobEntrySize(baseBlobId_.size() + idSize, dataSize,
+                         options_.checksums);
+}
+
+std::optional<std::string_view>
+    BinaryStore::relativeId(std::string_view blobId) const
+{
+    if (!blobId.starts_with(baseBlobId_))
+    {
+        return std::nullopt;
+    }
+    return blobId.substr(baseBlobId_.size());
+}
+
+bool BinaryStore::payloadsInSysfile() const
+{
+    return options_.lazyLoad && !compressedImage_;
+}
+
+std::vector<uint8_t> BinaryStore::readPayload(const Blob& blob) const
+{
+    /* Owned payloads are in memory even when the rest are in the sysfile */
+    if (!payloadsInSysfile() || !blob.offset)
+    {
+        auto bytes = blob.bytes(arena_);
+        return {bytes.begin(), bytes.end()};
+    }
+
+    /* Offsets are relative to the image, which is the active slot if any */
+    std::vector<uint8_t> data(blob.storedSize);
+    if (imageFile().readToBuf(*blob.offset, data.size(),
+                              reinterpret_cast<char*>(data.data())) !=
+        data.size())
+    {
+        throw std::runtime_error("Blob payload is truncated in sysfile");
+    }
+    return data;
+}
+
+void BinaryStore::ownBlob(Blob& blob)
+{
+    if (blob.offset)
+    {
+        blob.data = readPayload(blob);
+        blob.offset.reset();
+        if (payloadsInSysfile() && !verifyChecksum(blob, blob.data))
+        {
+            log<level::ERR>("Blob payload failed its checksum");
+        }
+    }
+}
+
+bool BinaryStore::verifyChecksum(Blob& blob, std::span<const uint8_t> payload)
+{
+    if (blob.crc && crc32c(payload) != *blob.crc)
+    {
+        blob.checksumError = true;
+    }
+    return !blob.checksumError;
+}
+
+BinaryStore::Blob& BinaryStore::sessionBlob(Session& session)
+{
+    const auto id = std::string_view(session.blobId).substr(baseBlobId_.size());
+    if (session.blobIndex >= blobs_.size() ||
+        blobs_.nth(session.blobIndex)->first != id)
+    {
+        session.blobIndex = blobs_.index_of(blobs_.find(id));
+    }
+    return blobs_.nth(session.blobIndex)->second;
+}
+
+std::string BinaryStore::getBaseBlobId() const
+{
+    return baseBlobId_;
+}
+
+bool BinaryStore::setBaseBlobId(const std::string& baseBlobId)
+{
+    /* Blobs are keyed relative to the base id and don't change */
+    for (auto& [id, session] : sessions_)
+    {
+        if (session.blobId.starts_with(baseBlobId_))
+        {
+            session.blobId = stdplus::strCat(
+                baseBlobId,
+                std::string_view(session.blobId).substr(baseBlobId_.size()));
+        }
+    }
+    baseBlobId_ = baseBlobId;
+    recalcEncodedSize();
+    ++generation_;
+    ++blobIdsGeneration_;
+    return persist();
+}
+
+std::vector<std::string> BinaryStore::getBlobIds() const
+{
+    std::vector<std::string> result;
+    result.reserve(blobs_.size() + 1);
+    result.emplace_back(getBaseBlobId());
+    for (const auto& kv : blobs_)
+    {
+        result.emplace_back(stdplus::strCat(baseBlobId_, kv.first));
+    }
+    return result;
+}
+
+uint64_t BinaryStore::getBlobIdsGeneration() const
+{
+    return blobIdsGeneration_;
+}
+
+bool BinaryStore::openOrCreateBlob(uint16_t session, const std::string& blobId,
+                                   uint16_t flags)
+{
+    if (!(flags & blobs::OpenFlags::read))
+    {
+        log<level::ERR>("OpenFlags::read not specified when opening",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    if (sessions_.contains(session))
+    {
+        log<level::ERR>("Session already has a blob open",
+                        entry("SESSION=%d", session),
+                        entry("RECEIVED=%s", blobId.c_str()));
+        return false;
+    }
+
+    const auto id = relativeId(blobId);
+    if (!id)
+    {
+        log<level::ERR>("Blob id doesn't start with the base id",
+                        entry("BASE_ID=%s", baseBlobId_.c_str()),
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    const bool writable = flags & blobs::OpenFlags::write;
+    if (readOnly_ && writable)
+    {
+        log<level::ERR>("Can't open the blob for writing: read-only store",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    if (writable && std::any_of(sessions_.begin(), sessions_.end(),
+                                [&](const auto& s) {
+                                    return s.second.writable &&
+                                           s.second.blobId == blobId;
+                                }))
+    {
+        log<level::ERR>("Blob is already open for writing",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    /* Apply a held back commit its worker already wrote */
+    flushWriteBack(false);
+
+    /* If there are uncommitted data no other session works on, discard
+     * them. */
+    if (sessions_.empty() && !this->loadSerializedData())
+    {
+        return false;
+    }
+
+    /* Iterate and find if there is an existing blob with this id.
+     * blobsPtr points to a BinaryBlob container with STL-like semantics*/
+    if (auto it = blobs_.find(*id); it != blobs_.end())
+    {
+        try
+        {
+            if (payloadsInSysfile())
+            {
+                ownBlob(it->second);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            log<level::ERR>("Reading blob payload from sysfile failed",
+                            entry("BLOB_ID=%s", blobId.c_str()),
+                            entry("ERROR=%s", e.what()));
+            return false;
+        }
+        sessions_[session] = {{blobId, writable}, blobs_.index_of(it)};
+        return true;
+    }
+
+    /* Otherwise, create the blob and append it */
+    if (readOnly_)
+    {
+        return false;
+    }
+
+    auto it = blobs_.emplace(std::string(*id), Blob{}).first;
+    encodedSize_ += entrySize(id->size(), 0);
+    sessions_[session] = {{blobId, writable}, blobs_.index_of(it)};
+    commitState_ = CommitState::Dirty;
+    ++generation_;
+    ++blobIdsGeneration_;
+    return true;
+}
+
+bool BinaryStore::deleteBlob(const std::string& blobId)
+{
+    if (readOnly_)
+    {
+        log<level::ERR>("Can't delete the blob: read-only store",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    if (std::any_of(sessions_.begin(), sessions_.end(), [&](const auto& s) {
+            return s.second.blobId == blobId;
+        }))
+    {
+        log<level::ERR>("Can't delete an open blob",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    if (sessions_.empty())
+    {
+        /* If there are uncommitted data, discard them. */
+        if (!this->loadSerializedData())
+        {
+            return false;
+        }
+    }
+    else if (!changesCommitted())
+    {
+        /* Committing the deletion would also commit the open sessions'
+         * writes */
+        log<level::ERR>("Can't delete while open sessions have uncommitted "
+                        "changes",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    const auto id = relativeId(blobId);
+    auto it = id ? blobs_.find(*id) : blobs_.end();
+    if (it == blobs_.end())
+    {
+        return false;
+    }
+
+    encodedSize_ -= entrySize(id->size(), it->second.size());
+    blobs_.erase(it);
+    commitState_ = CommitState::Dirty;
+    ++generation_;
+    ++blobIdsGeneration_;
+    /* Deletions have no commit of their own, persist it right away */
+    return persist();
+}
+
+std::span<const uint8_t> BinaryStore::readView(uint16_t session,
+                                               uint32_t offset,
+                                               uint32_t requestedSize)
+{
+    auto it = sessions_.find(session);
+    if (it == sessions_.end())
+    {
+        log<level::ERR>("No open blob to read", entry("SESSION=%d", session));
+        return {};
+    }
+
+    const auto data = sessionBlob(it->second).bytes(arena_);
+
+    /* If it is out of bound, return an empty view */
+    if (offset >= data.size())
+    {
+        log<level::ERR>("Read offset is beyond data size",
+                        entry("MAX_SIZE=0x%x", data.size()),
+                        entry("RECEIVED_OFFSET=0x%x", offset));
+        return {};
+    }
+
+    return data.subspan(offset, std::min<size_t>(requestedSize,
+                                                 data.size() - offset));
+}
+
+std::vector<uint8_t> BinaryStore::readBlob(const std::string& blobId) const
+{
+    const auto id = relativeId(blobId);
+    const auto blobIt = id ? blobs_.find(*id) : blobs_.end();
+    if (blobIt == blobs_.end())
+    {
+        throw ipmi::HandlerCompletion(ipmi::ccUnspecifiedError);
+    }
+    return readPayload(blobIt->second);
+}
+
+std::span<const uint8_t> BinaryStore::readBlobView(const std::string& blobId)
+{
+    const auto id = relativeId(blobId);
+    const auto blobIt = id ? blobs_.find(*id) : blobs_.end();
+    if (blobIt == blobs_.end())
+    {
+        throw ipmi::HandlerCompletion(ipmi::ccUnspecifiedError);
+    }
+    /* A payload left in the sysfile has to be read once to be viewed */
+    if (payloadsInSysfile())
+    {
+        ownBlob(blobIt->second);
+    }
+    return blobIt->second.bytes(arena_);
+}
+
+/* Blobs to encode along with the arena their shared payloads live in */
+template <typename Blobs>
+struct EncodeSource
+{
+    const Blobs* blobs;
+    std::string_view arena;
+    /* Blobs are keyed by their id relative to it */
+    std::string_view baseId;
+    /* Whether the crc of each blob is encoded */
+    bool checksums;
+};
+
+template <typename Blobs>
+static binstore_binaryblobproto_BinaryBlobBase
+    makeEncoder(const std::string& base,
+                const EncodeSource<Blobs>& source) noexcept
+{
+    static constexpr auto blobcb = [](pb_ostream_t* stream,
                                       const pb_field_iter_t* field,
                                       void* const* arg) noexcept {
-        const auto& blobs = *reinterpret_cast<const Blobs*>(*arg);
-        for (const auto& [id, data] : blobs)
+        const auto& source =
+            *reinterpret_cast<const EncodeSource<Blobs>*>(*arg);
+        for (const auto& [id, blob] : *source.blobs)
+        {
+            const auto data = blob.bytes(source.arena);
+            const SplitId fullId = {source.baseId, id};
+            binstore_binaryblobproto_BinaryBlob msg = {
+                .blob_id = pbSplitIdEncoder(fullId),
+                .data = pbStrEncoder(data),
+                .has_crc = source.checksums && blob.crc.has_value(),
+                .crc = blob.crc.value_or(0),
+            };
+            if (!pb_encode_tag_for_field(stream, field) ||
+                !pb_encode_submessage(
+                    stream, binstore_binaryblobproto_BinaryBlob_fields, &msg))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    return {
+        .blob_base_id = pbStrEncoder(base),
+        .blobs = {{.encode = blobcb},
+                  const_cast<void*>(reinterpret_cast<const void*>(&source))},
+    };
+}
+
+bool BinaryStore::write(uint16_t session, uint32_t offset,
+                        std::span<const uint8_t> data)
+{
+    auto it = sessions_.find(session);
+    if (it == sessions_.end())
+    {
+        log<level::ERR>("No open blob to write", entry("SESSION=%d", session));
+        return false;
+    }
+
+    if (!it->second.writable)
+    {
+        log<level::ERR>("Open blob is not writable");
+        return false;
+    }
+
+    const size_t idSize = it->second.blobId.size() - baseBlobId_.size();
+    auto& blob = sessionBlob(it->second);
+    const auto current = blob.bytes(arena_);
+    if (offset > current.size())
+    {
+        log<level::ERR>("Write would leave a gap with undefined data. Return.");
+        return false;
+    }
+
+    /* Rewriting identical bytes doesn't need to be committed again */
+    if (offset + data.size() <= current.size() &&
+        std::equal(data.begin(), data.end(), current.begin() + offset))
+    {
+        return true;
+    }
+
+    /* Only the size of the open blob can change, so the new total is derived
+     * from the running tally instead of re-encoding every blob. */
+    std::size_t reqSize =
+        std::max<std::size_t>(current.size(), offset + data.size());
+    std::size_t newSize = encodedSize_ -
+                          entrySize(idSize, current.size()) +
+                          entrySize(idSize, reqSize);
+    if (newSize > maxEncodedSize())
+    {
+        log<level::ERR>("Write data would make the total size exceed the max "
+                        "size allowed. Return.");
+        return false;
+    }
+
+    /* Copy on write: the payload only leaves the arena once it changes */
+    ownBlob(blob);
+    auto& bdata = blob.data;
+    bdata.resize(reqSize);
+    encodedSize_ = newSize;
+    blob.crc.reset();
+    blob.checksumError = false;
+    commitState_ = CommitState::Dirty;
+    ++generation_;
+    dirtyBytes_ += data.size();
+    /* What a flat commit has to rewrite in place */
+    if (blob.flatDirtyBegin == blob.flatDirtyEnd)
+    {
+        blob.flatDirtyBegin = offset;
+        blob.flatDirtyEnd = offset;
+    }
+    blob.flatDirtyBegin = std::min<uint32_t>(blob.flatDirtyBegin, offset);
+    blob.flatDirtyEnd =
+        std::max<uint32_t>(blob.flatDirtyEnd, offset + data.size());
+    blob.flatDirtyGeneration = generation_;
+    std::copy(data.begin(), data.end(), bdata.data() + offset);
+    return true;
+}
+
+/* State of a nanopb output stream writing to a SysFile through a fixed size
+ * buffer */
+struct SysFileSink
+{
+    SysFile* file;
+    /* Sysfile position of the first buffered byte */
+    size_t pos;
+    std::string buf;
+    /* CRC32C of everything flushed so far */
+    uint32_t crc = 0;
+    /* Exception thrown by the SysFile, nanopb can't propagate it */
+    std::exception_ptr error = nullptr;
+
+    void flush()
+    {
+        file->writeStr(buf, pos);
+        crc = crc32c(buf, crc);
+        pos += buf.size();
+        buf.clear();
+    }
+};
+
+static bool sysFileSinkWrite(pb_ostream_t* stream, const pb_byte_t* buf,
+                             size_t count) noexcept
+{
+    auto& s = *reinterpret_cast<SysFileSink*>(stream->state);
+    try
+    {
+        while (count > 0)
+        {
+            size_t n = std::min(count, commitChunkSize - s.buf.size());
+            s.buf.append(reinterpret_cast<const char*>(buf), n);
+            buf += n;
+            count -= n;
+            if (s.buf.size() == commitChunkSize)
+            {
+                s.flush();
+            }
+        }
+    }
+    catch (...)
+    {
+        s.error = std::current_exception();
+        return false;
+    }
+    return true;
+}
+
+/* Encode |msg| into a length-prefixed image of |size| bytes.
+ * @throws std::runtime_error if the encoded size doesn't match */
+static std::string
+    encodeImage(const binstore_binaryblobproto_BinaryBlobBase& msg, size_t size)
+{
+    /* Store as little endian to be platform agnostic. Consistent with read. */
+    std::string buf(size, '\0');
+    auto& prefix =
+        *reinterpret_cast<boost::endian::little_uint64_t*>(buf.data());
+    auto ost = pb_ostream_from_buffer(reinterpret_cast<pb_byte_t*>(buf.data()) +
+                                          sizeof(prefix),
+                                      buf.size() - sizeof(prefix));
+    if (!pb_encode(&ost, binstore_binaryblobproto_BinaryBlobBase_fields,
+                   &msg) ||
+        ost.bytes_written != buf.size() - sizeof(prefix))
+    {
+        throw std::runtime_error(
+            stdplus::strCat("Encoded size does not match the accounted size: ",
+                            PB_GET_ERROR(&ost)));
+    }
+    prefix = ost.bytes_written;
+    return buf;
+}
+
+/* Encode |msg| straight to the sysfile as a length-prefixed image of |size|
+ * bytes, so memory use is bounded by |commitChunkSize| rather than the size of
+ * the store. The length prefix is written last, once the proto is complete.
+ * @returns CRC32C of the encoded proto
+ * @throws std::system_error if writing fails, std::runtime_error if the
+ *     encoded size doesn't match */
+static uint32_t streamImage(SysFile& file,
+                            const binstore_binaryblobproto_BinaryBlobBase& msg,
+                            size_t size)
+{
+    boost::endian::little_uint64_t prefix = 0;
+    SysFileSink sink = {.file = &file,
+                        .pos = sizeof(prefix),
+                        .buf = {},
+                        .crc = 0,
+                        .error = nullptr};
+    sink.buf.reserve(commitChunkSize);
+    pb_ostream_t ost = {
+        .callback = sysFileSinkWrite,
+        .state = &sink,
+        .max_size = size - sizeof(prefix),
+        .bytes_written = 0,
+        .errmsg = nullptr,
+    };
+    if (!pb_encode(&ost, binstore_binaryblobproto_BinaryBlobBase_fields,
+                   &msg))
+    {
+        if (sink.error)
+        {
+            std::rethrow_exception(sink.error);
+        }
+        throw std::runtime_error(stdplus::strCat(
+            "Encoding to sysfile failed: ", PB_GET_ERROR(&ost)));
+    }
+    if (ost.bytes_written != size - sizeof(prefix))
+    {
+        throw std::runtime_error(
+            "Encoded size does not match the accounted size");
+    }
+    sink.flush();
+
+    prefix = ost.bytes_written;
+    file.writeStr(
+        std::string(reinterpret_cast<const char*>(&prefix), sizeof(prefix)),
+        0);
+    return sink.crc;
+}
+
+bool BinaryStore::commit(uint16_t session)
+{
+    if (!sessions_.contains(session))
+    {
+        log<level::ERR>("No open blob to commit", entry("SESSION=%d", session));
+        return false;
+    }
+
+    return persist();
+}
+
+bool BinaryStore::persist()
+{
+    if (readOnly_)
+    {
+        log<level::ERR>("ReadOnly blob, not committing");
+        return false;
+    }
+
+    /* The previous snapshot has to be written before writing the next one */
+    finishAsyncCommit(true);
+
+    auto outSize = encodedSize_;
+    if (outSize > maxEncodedSize())
+    {
+        log<level::ERR>("Commit Data exceeded maximum allowed size");
+        return false;
+    }
+
+    /* Nothing changed since the last load or commit, skip the write. An
+     * uninitialized sysfile still gets a valid (empty) image. A held-back
+     * snapshot only makes the store clean once it is written. */
+    if (commitState_ != CommitState::Uninitialized && changesCommitted())
+    {
+        if (persistedGeneration_ == generation_)
+        {
+            commitState_ = CommitState::Clean;
+        }
+        return true;
+    }
+
+    /* The snapshot held back is replaced, and the sysfile has to be left to
+     * this commit */
+    dropWriteBack();
+
+    /* Payloads not read yet must be in memory before the image they live in
+     * gets overwritten. Only payloads changed since they were persisted need
+     * a new checksum, which flat images always hold. */
+    const bool checksums = options_.checksums ||
+                           imageFormat_ == ImageFormat::Flat;
+    try
+    {
+        for (auto& [id, blob] : blobs_)
+        {
+            if (payloadsInSysfile())
+            {
+                ownBlob(blob);
+            }
+            if (checksums && !blob.crc)
+            {
+                blob.crc = crc32c(blob.bytes(arena_));
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Reading blob payloads from sysfile failed",
+                        entry("ERROR=%s", e.what()));
+        return false;
+    }
+
+    const EncodeSource<decltype(blobs_)> source = {
+        &blobs_, arena_, baseBlobId_, options_.checksums};
+    auto msg = makeEncoder(baseBlobId_, source);
+    /* Commits written later need a snapshot of what they write */
+    const bool deferred = options_.writeBackDelay ||
+                          options_.writeBackDirtyBytes ||
+                          options_.asyncCommit;
+    try
+    {
+        if (imageFormat_ == ImageFormat::Flat && !deferred)
+        {
+            /* Each write is done as soon as it is planned, so neither the
+             * image nor the changed payloads are copied as a whole */
+            auto commit = planFlatCommit([](ImageWrite write) {
+                write.file->writeStr(write.data, write.pos);
+            });
+            applySnapshot(commit);
+            return true;
+        }
+
+        /* The max size applies to what ends up in the sysfile */
+        std::optional<SnapshotCommit> snapshot;
+        if (imageFormat_ == ImageFormat::Flat)
+        {
+            std::vector<ImageWrite> writes;
+            snapshot = planFlatCommit([&writes](ImageWrite write) {
+                writes.push_back(std::move(write));
+            });
+            snapshot->writes = std::move(writes);
+        }
+        else if (options_.compression != Compression::None)
+        {
+            auto image = compressImage(encodeImage(msg, outSize));
+            if (image.size() > maxImageSize())
+            {
+                log<level::ERR>("Compressed commit data exceeded maximum "
+                                "allowed size");
+                return false;
+            }
+            snapshot = planSnapshot(std::move(image), generation_);
+        }
+        auto takeSnapshot = [&] {
+            return snapshot ? std::move(*snapshot)
+                            : planSnapshot(encodeImage(msg, outSize),
+                                           generation_);
+        };
+
+        if (options_.writeBackDelay || options_.writeBackDirtyBytes)
+        {
+            /* Hold the snapshot back, a later commit replaces it */
+            holdBack(takeSnapshot());
+            if (options_.writeBackDirtyBytes &&
+                dirtyBytes_ >= *options_.writeBackDirtyBytes)
+            {
+                return flushWriteBack(true);
+            }
+            return true;
+        }
+        if (options_.asyncCommit)
+        {
+            /* The worker writes a snapshot, stat() reports the outcome */
+            startAsyncCommit(takeSnapshot());
+            return true;
+        }
+        if (snapshot)
+        {
+            return writeSnapshot(std::move(*snapshot));
+        }
+        if (options_.slotSize)
+        {
+            commitToSlot(streamImage(*slots_[activeSlot_ ^ 1], msg, outSize),
+                         outSize);
+        }
+        else if (options_.deltaCommitGranularity)
+        {
+            /* Delta commits need the whole image to compare against */
+            writeImage(encodeImage(msg, outSize));
+        }
+        else
+        {
+            streamImage(*file_, msg, outSize);
+            /* Left over from a flat image this one replaces */
+            persistedImage_.clear();
+            ++commitStats_.commits;
+            commitStats_.bytesWritten += outSize;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        commitFailed(e);
+        return false;
+    };
+
+    commitState_ = CommitState::Clean;
+    persistedGeneration_ = generation_;
+    return true;
+}
+
+BinaryStore::SnapshotCommit BinaryStore::planFlatCommit(
+    const std::function<void(ImageWrite)>& write)
+{
+    SnapshotCommit commit = {.writes = {},
+                             .generation = generation_,
+                             .image = {},
+                             .bytesWritten = 0,
+                             .slot = std::nullopt};
+    auto add = [&](SysFile* file, size_t pos, std::string data) {
+        commit.bytesWritten += data.size();
+        write({file, pos, std::move(data)});
+    };
+
+    std::vector<flat::Extent> extents;
+    extents.reserve(blobs_.size());
+    for (const auto& [id, blob] : blobs_)
+    {
+        extents.push_back({
+            .id = id,
+            .offset = blob.flatOffset,
+            .length = static_cast<uint32_t>(blob.size()),
+            .capacity = blob.flatCapacity,
+            .crc = blob.crc.value_or(0),
+        });
+    }
+    const size_t imageSize = flat::place(baseBlobId_, extents,
+                                         maxImageSize());
+
+    /* A slot holds none of the payloads of the image it replaces */
+    SysFile* file = options_.slotSize ? slots_[activeSlot_ ^ 1].get()
+                                      : file_.get();
+    const bool rewriteAll = options_.slotSize || !persistedGeneration_;
+    auto extent = extents.begin();
+    for (auto& [id, blob] : blobs_)
+    {
+        /* A payload written to a new place is padded up to its capacity, so
+         * the image always spans all of it */
+        if (extent->offset != blob.flatOffset)
         {
-            binstore_binaryblobproto_BinaryBlob msg = {
-                .blob_id = pbStrEncoder(id),
-                .data = pbStrEncoder(data),
-            };
-            if (!pb_encode_tag_for_field(stream, field) ||
-                !pb_encode_submessage(
-                    stream, binstore_binaryblobproto_BinaryBlob_fields, &msg))
+            blob.flatOffset = extent->offset;
+            blob.flatDirtyBegin = 0;
+            blob.flatDirtyEnd = extent->capacity;
+            blob.flatDirtyGeneration = generation_;
+        }
+        blob.flatCapacity = extent->capacity;
+        ++extent;
+
+        size_t begin = blob.flatDirtyBegin / flat::alignment * flat::alignment;
+        size_t end = std::min<size_t>(flat::alignUp(blob.flatDirtyEnd),
+                                      blob.flatCapacity);
+        if (rewriteAll)
+        {
+            begin = 0;
+            end = blob.flatCapacity;
+        }
+        const auto payload = blob.bytes(arena_);
+        for (size_t pos = begin; pos < end; pos += commitChunkSize)
+        {
+            std::string chunk(std::min(commitChunkSize, end - pos), '\0');
+            if (pos < payload.size())
             {
-                return false;
+                std::copy_n(payload.begin() + pos,
+                            std::min(chunk.size(), payload.size() - pos),
+                            chunk.begin());
             }
+            add(file, blob.flatOffset + pos, std::move(chunk));
+        }
+    }
+
+    /* The index goes last, so it never points at payloads not written yet */
+    auto index = flat::encodeIndex(baseBlobId_, extents, imageSize);
+    if (options_.slotSize)
+    {
+        /* The slot header checks the index and the payloads, so a slot torn
+         * anywhere falls back to the other one */
+        auto crc = crc32c(std::string_view(index).substr(
+            sizeof(boost::endian::little_uint64_t)));
+        for (const auto& [id, blob] : blobs_)
+        {
+            crc = crc32c(blob.bytes(arena_), crc);
+        }
+        auto header = slotHeaderWrite(crc, imageSize);
+        add(file, 0, std::move(index));
+        add(header.file, header.pos, std::move(header.data));
+        commit.slot = activeSlot_ ^ 1;
+    }
+    else
+    {
+        for (auto& delta : deltaWrites(index))
+        {
+            add(delta.file, delta.pos, std::move(delta.data));
         }
+        commit.image = std::move(index);
+    }
+    return commit;
+}
+
+bool BinaryStore::setImageFormat(ImageFormat format)
+{
+    if (readOnly_ || !sessions_.empty())
+    {
+        log<level::ERR>("Image format can only change with no open sessions",
+                        entry("BASE_ID=%s", baseBlobId_.c_str()));
+        return false;
+    }
+    if (!loadSerializedData())
+    {
+        return false;
+    }
+    /* Whatever the sysfile holds isn't a store, don't overwrite it */
+    if (commitState_ == CommitState::Uninitialized)
+    {
+        log<level::ERR>("No image to convert in the sysfile",
+                        entry("BASE_ID=%s", baseBlobId_.c_str()));
+        return false;
+    }
+    if (format == imageFormat_ && commitState_ == CommitState::Clean)
+    {
         return true;
+    }
+
+    const auto previous = imageFormat_;
+    imageFormat_ = format;
+    /* None of the payloads are in place in the new image */
+    for (auto& [id, blob] : blobs_)
+    {
+        blob.flatOffset = 0;
+        blob.flatCapacity = 0;
+    }
+    recalcEncodedSize();
+    ++generation_;
+    commitState_ = CommitState::Dirty;
+    /* The sysfile has to hold the new format once this returns */
+    if (persist() && flushWriteBack(true))
+    {
+        finishAsyncCommit(true);
+        if (commitState_ == CommitState::Clean)
+        {
+            return true;
+        }
+    }
+
+    imageFormat_ = previous;
+    recalcEncodedSize();
+    return false;
+}
+
+ImageFormat BinaryStore::getImageFormat() const
+{
+    return imageFormat_;
+}
+
+BinaryStore::ImageWrite BinaryStore::slotHeaderWrite(uint32_t protoCrc,
+                                                     size_t imageSize) const
+{
+    SlotHeader header;
+    header.magic = slotMagic;
+    header.sequence = slotSequence_ + 1;
+    header.protoSize = imageSize - sizeof(boost::endian::little_uint64_t);
+    header.protoCrc = protoCrc;
+    header.headerCrc = slotHeaderCrc(header);
+    return {file_.get(), (activeSlot_ ^ 1) * *options_.slotSize,
+            std::string(reinterpret_cast<const char*>(&header),
+                        sizeof(header))};
+}
+
+void BinaryStore::commitToSlot(uint32_t protoCrc, size_t imageSize)
+{
+    /* The image is complete in the inactive slot, writing its header makes it
+     * the current one. A torn header fails its checksum and leaves the other
+     * slot current. */
+    auto header = slotHeaderWrite(protoCrc, imageSize);
+    header.file->writeStr(header.data, header.pos);
+
+    activeSlot_ ^= 1;
+    ++slotSequence_;
+    ++commitStats_.commits;
+    commitStats_.bytesWritten += imageSize + header.data.size();
+}
+
+size_t BinaryStore::maxImageSize() const
+{
+    size_t limit = maxSize.value_or(
+        std::numeric_limits<std::decay_t<decltype(*maxSize)>>::max());
+    if (options_.slotSize)
+    {
+        limit = std::min<size_t>(limit,
+                                 *options_.slotSize - sizeof(SlotHeader));
+    }
+    return limit;
+}
+
+size_t BinaryStore::maxEncodedSize() const
+{
+    size_t limit = maxImageSize();
+    if (options_.compression == Compression::None ||
+        imageFormat_ == ImageFormat::Flat)
+    {
+        return limit;
+    }
+    /* Only the commit knows whether the compressed image fits, this just
+     * rejects data that can't possibly fit */
+    return limit > std::numeric_limits<size_t>::max() / lz4MaxRatio
+               ? std::numeric_limits<size_t>::max()
+               : limit * lz4MaxRatio;
+}
+
+void BinaryStore::writeImage(const std::string& image)
+{
+    ++commitStats_.commits;
+    for (const auto& write : deltaWrites(image))
+    {
+        write.file->writeStr(write.data, write.pos);
+        commitStats_.bytesWritten += write.data.size();
+    }
+    persistedImage_ = image;
+}
+
+std::vector<BinaryStore::ImageWrite>
+    BinaryStore::deltaWrites(const std::string& image) const
+{
+    if (persistedImage_.empty())
+    {
+        return {{file_.get(), 0, image}};
+    }
+
+    std::vector<ImageWrite> writes;
+    const size_t block = std::max<size_t>(
+        options_.deltaCommitGranularity.value_or(flat::alignment), 1);
+    auto flush = [&](size_t start, size_t end) {
+        writes.push_back(
+            {file_.get(), start, image.substr(start, end - start)});
     };
-    return {
-        .blob_base_id = pbStrEncoder(base),
-        .blobs = {{.encode = blobcb},
-                  const_cast<void*>(reinterpret_cast<const void*>(&blobs))},
-    };
+    size_t dirtyStart = std::string::npos;
+    for (size_t pos = 0; pos < image.size(); pos += block)
+    {
+        size_t len = std::min(block, image.size() - pos);
+        bool dirty = pos + len > persistedImage_.size() ||
+                     image.compare(pos, len, persistedImage_, pos, len) != 0;
+        if (dirty && dirtyStart == std::string::npos)
+        {
+            dirtyStart = pos;
+        }
+        else if (!dirty && dirtyStart != std::string::npos)
+        {
+            flush(dirtyStart, pos);
+            dirtyStart = std::string::npos;
+        }
+    }
+    if (dirtyStart != std::string::npos)
+    {
+        flush(dirtyStart, image.size());
+    }
+    return writes;
 }
 
-static std::size_t
-    payloadCalcSize(const binstore_binaryblobproto_BinaryBlobBase& msg)
+BinaryStore::SnapshotCommit BinaryStore::planSnapshot(std::string image,
+                                                      uint64_t generation) const
 {
-    pb_ostream_t nost = {};
-    if (!pb_encode(&nost, binstore_binaryblobproto_BinaryBlobBase_fields, &msg))
+    SnapshotCommit commit = {.writes = {},
+                             .generation = generation,
+                             .image = {},
+                             .bytesWritten = 0,
+                             .slot = std::nullopt};
+    if (options_.slotSize)
     {
-        throw std::runtime_error(
-            std::format("Calculating msg size: {}", PB_GET_ERROR(&nost)));
+        auto protoCrc = crc32c(std::string_view(image).substr(
+            sizeof(boost::endian::little_uint64_t)));
+        auto header = slotHeaderWrite(protoCrc, image.size());
+        commit.slot = activeSlot_ ^ 1;
+        commit.writes.push_back(
+            {slots_[*commit.slot].get(), 0, std::move(image)});
+        commit.writes.push_back(std::move(header));
+    }
+    else if (options_.deltaCommitGranularity ||
+             imageFormat_ == ImageFormat::Flat)
+    {
+        commit.writes = deltaWrites(image);
+        commit.image = std::move(image);
+    }
+    else
+    {
+        commit.writes.push_back({file_.get(), 0, std::move(image)});
+    }
+    for (const auto& write : commit.writes)
+    {
+        commit.bytesWritten += write.data.size();
     }
-    // Proto is prepended with the size of the proto
-    return nost.bytes_written + sizeof(boost::endian::little_uint64_t);
+    return commit;
 }
 
-bool BinaryStore::write(uint32_t offset, const std::vector<uint8_t>& data)
+void BinaryStore::applySnapshot(SnapshotCommit& commit)
 {
-    if (currentBlob_.empty())
+    if (commit.slot)
     {
-        log<level::ERR>("No open blob to write");
-        return false;
+        activeSlot_ = *commit.slot;
+        ++slotSequence_;
+    }
+    persistedImage_ = std::move(commit.image);
+    ++commitStats_.commits;
+    commitStats_.bytesWritten += commit.bytesWritten;
+    persistedGeneration_ = commit.generation;
+    /* Payloads in a flat image now match the sysfile up to the snapshot */
+    for (auto& [id, blob] : blobs_)
+    {
+        if (blob.flatDirtyGeneration <= commit.generation)
+        {
+            blob.flatDirtyBegin = 0;
+            blob.flatDirtyEnd = 0;
+        }
     }
+    /* Changes made since the snapshot still need a commit */
+    commitState_ = commit.generation == generation_ ? CommitState::Clean
+                                                    : CommitState::Dirty;
+}
 
-    if (!writable_)
+bool BinaryStore::writeSnapshot(SnapshotCommit commit)
+{
+    if (options_.asyncCommit)
     {
-        log<level::ERR>("Open blob is not writable");
-        return false;
+        startAsyncCommit(std::move(commit));
+        return true;
     }
 
-    auto& bdata = blobs_.find(currentBlob_)->second;
-    if (offset > bdata.size())
+    try
     {
-        log<level::ERR>("Write would leave a gap with undefined data. Return.");
+        for (const auto& write : commit.writes)
+        {
+            write.file->writeStr(write.data, write.pos);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        commitFailed(e);
         return false;
     }
+    applySnapshot(commit);
+    return true;
+}
+
+void BinaryStore::commitFailed(const std::exception& e)
+{
+    /* Part of the image might have been written */
+    persistedImage_.clear();
+    persistedGeneration_.reset();
+    commitState_ = CommitState::CommitError;
+    log<level::ERR>("Writing to sysfile failed", entry("ERROR=%s", e.what()));
+}
+
+void BinaryStore::startAsyncCommit(SnapshotCommit commit)
+{
+    /* The writes only reference sysfiles owned by the store, which waits for
+     * the worker before it goes away: the destructor of a future from
+     * std::async blocks until the task is done. */
+    auto done = std::async(std::launch::async,
+                           [writes = std::move(commit.writes)]() {
+                               for (const auto& write : writes)
+                               {
+                                   write.file->writeStr(write.data, write.pos);
+                               }
+                           });
+    asyncCommit_ = AsyncCommit{std::move(done), std::move(commit)};
+}
 
-    std::size_t oldsize = bdata.size(), reqSize = offset + data.size();
-    if (reqSize > bdata.size())
+void BinaryStore::holdBack(SnapshotCommit commit)
+{
+    writeBack_ = WriteBack{std::move(commit), {}, nullptr};
+    if (!options_.writeBackDelay)
     {
-        bdata.resize(reqSize);
+        return;
     }
 
-    if (payloadCalcSize(makeEncoder(baseBlobId_, blobs_)) >
-        maxSize.value_or(
-            std::numeric_limits<std::decay_t<decltype(*maxSize)>>::max()))
+    /* Like an async commit, the writes only reference sysfiles owned by the
+     * store, which waits for the worker before it goes away */
+    auto timer = std::make_shared<WriteBackTimer>();
+    const auto deadline =
+        std::chrono::steady_clock::now() + *options_.writeBackDelay;
+    writeBack_->timer = timer;
+    writeBack_->written = std::async(
+        std::launch::async,
+        [writes = std::move(writeBack_->commit.writes), timer, deadline]() {
+            {
+                std::unique_lock lock(timer->mutex);
+                timer->wake.wait_until(lock, deadline, [&timer] {
+                    return timer->due || timer->dropped;
+                });
+                if (timer->dropped)
+                {
+                    return false;
+                }
+            }
+            for (const auto& write : writes)
+            {
+                write.file->writeStr(write.data, write.pos);
+            }
+            return true;
+        });
+}
+
+bool BinaryStore::flushWriteBack(bool force)
+{
+    if (!writeBack_)
     {
-        log<level::ERR>("Write data would make the total size exceed the max "
-                        "size allowed. Return.");
-        bdata.resize(oldsize);
-        return false;
+        return true;
+    }
+    if (writeBack_->written.valid())
+    {
+        if (force)
+        {
+            std::lock_guard lock(writeBack_->timer->mutex);
+            writeBack_->timer->due = true;
+            writeBack_->timer->wake.notify_one();
+        }
+        else if (writeBack_->written.wait_for(std::chrono::seconds(0)) !=
+                 std::future_status::ready)
+        {
+            return true;
+        }
+        return finishWriteBack();
+    }
+    if (!force)
+    {
+        return true;
     }
 
-    commitState_ = CommitState::Dirty;
-    std::copy(data.begin(), data.end(), bdata.data() + offset);
-    return true;
+    auto writeBack = std::move(*writeBack_);
+    writeBack_.reset();
+    dirtyBytes_ = 0;
+    /* A snapshot still being written has to be done before the next one */
+    finishAsyncCommit(true);
+    return writeSnapshot(std::move(writeBack.commit));
 }
 
-bool BinaryStore::commit()
+void BinaryStore::dropWriteBack()
 {
-    if (readOnly_)
+    if (!writeBack_)
     {
-        log<level::ERR>("ReadOnly blob, not committing");
+        return;
+    }
+    if (!writeBack_->written.valid())
+    {
+        writeBack_.reset();
+        return;
+    }
+    {
+        std::lock_guard lock(writeBack_->timer->mutex);
+        writeBack_->timer->dropped = true;
+        writeBack_->timer->wake.notify_one();
+    }
+    finishWriteBack();
+}
+
+bool BinaryStore::finishWriteBack()
+{
+    auto writeBack = std::move(*writeBack_);
+    writeBack_.reset();
+    try
+    {
+        if (!writeBack.written.get())
+        {
+            return true;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        commitFailed(e);
         return false;
     }
+    dirtyBytes_ = 0;
+    applySnapshot(writeBack.commit);
+    return true;
+}
 
-    /* Store as little endian to be platform agnostic. Consistent with read. */
-    auto msg = makeEncoder(baseBlobId_, blobs_);
-    auto outSize = payloadCalcSize(msg);
-    if (outSize >
-        maxSize.value_or(
-            std::numeric_limits<std::decay_t<decltype(*maxSize)>>::max()))
+bool BinaryStore::finishAsyncCommit(bool wait)
+{
+    if (!asyncCommit_)
+    {
+        return true;
+    }
+    if (!wait && asyncCommit_->done.wait_for(std::chrono::seconds(0)) !=
+                     std::future_status::ready)
     {
-        log<level::ERR>("Commit Data exceeded maximum allowed size");
         return false;
     }
-    std::string buf(outSize, '\0');
-    auto& size = *reinterpret_cast<boost::endian::little_uint64_t*>(buf.data());
-    auto ost = pb_ostream_from_buffer(reinterpret_cast<pb_byte_t*>(buf.data()) +
-                                          sizeof(size),
-                                      buf.size() - sizeof(size));
-    pb_encode(&ost, binstore_binaryblobproto_BinaryBlobBase_fields, &msg);
-    size = ost.bytes_written;
+
+    auto async = std::move(*asyncCommit_);
+    asyncCommit_.reset();
     try
     {
-        file_->writeStr(buf, 0);
+        async.done.get();
     }
     catch (const std::exception& e)
     {
-        commitState_ = CommitState::CommitError;
-        log<level::ERR>("Writing to sysfile failed",
-                        entry("ERROR=%s", e.what()));
+        commitFailed(e);
+        return true;
+    }
+    applySnapshot(async.commit);
+    return true;
+}
+
+bool BinaryStore::changesCommitted() const
+{
+    return persistedGeneration_ == generation_ ||
+           (writeBack_ && writeBack_->commit.generation == generation_);
+}
+
+const CommitStats& BinaryStore::getCommitStats() const
+{
+    return commitStats_;
+}
+
+bool BinaryStore::close(uint16_t session)
+{
+    if (!sessions_.erase(session))
+    {
+        log<level::ERR>("No open blob to close", entry("SESSION=%d", session));
         return false;
-    };
+    }
 
-    commitState_ = CommitState::Clean;
+    /* Commits acknowledged to the session must not outlive it in memory */
+    const bool flushed = flushWriteBack(true);
+
+    /* Once the last session is gone, uncommitted changes are discarded by
+     * reloading on the next open. If the sessions didn't change anything, the
+     * loaded data is still valid. A failed commit stays reported until then. */
+    if (sessions_.empty() && persistedGeneration_ != generation_ &&
+        commitState_ != CommitState::CommitError)
+    {
+        commitState_ = CommitState::Dirty;
+    }
+    return flushed;
+}
+
+uint16_t BinaryStore::commitStateFlags() const
+{
+    uint16_t blobState = commitState_;
+    if (asyncCommit_ || writeBack_)
+    {
+        blobState |= blobs::StateFlags::committing;
+    }
+    else if (commitState_ == CommitState::Clean)
+    {
+        blobState |= blobs::StateFlags::committed;
+    }
+    else if (commitState_ == CommitState::CommitError)
+    {
+        blobState |= blobs::StateFlags::commit_error;
+    }
+    return blobState;
+}
+
+bool BinaryStore::stat(blobs::BlobMeta* meta)
+{
+    flushWriteBack(false);
+    finishAsyncCommit(false);
+    meta->size = 0;
+    meta->blobState = commitStateFlags();
+    if (std::any_of(blobs_.begin(), blobs_.end(), [](const auto& b) {
+            return b.second.checksumError;
+        }))
+    {
+        meta->blobState |= CommitState::ChecksumError;
+    }
     return true;
 }
 
-bool BinaryStore::close()
+bool BinaryStore::statBlob(const std::string& blobId, blobs::BlobMeta* meta)
 {
-    currentBlob_.clear();
-    writable_ = false;
-    commitState_ = CommitState::Dirty;
+    flushWriteBack(false);
+    finishAsyncCommit(false);
+
+    /* Report what opening the blob would find. A commit still pending will
+     * persist what is in memory, so only reload if nothing is. */
+    if (sessions_.empty() && !asyncCommit_ && !writeBack_ &&
+        commitState_ == CommitState::Dirty && !loadSerializedData())
+    {
+        return false;
+    }
+
+    const auto id = relativeId(blobId);
+    const auto it = id ? blobs_.find(*id) : blobs_.end();
+    if (blobId == baseBlobId_ || it == blobs_.end())
+    {
+        return stat(meta);
+    }
+
+    /* The size is known from the index even if the payload wasn't read */
+    meta->size = it->second.size();
+    meta->blobState = commitStateFlags();
+    if (it->second.checksumError)
+    {
+        meta->blobState |= CommitState::ChecksumError;
+    }
     return true;
 }
 
 /*
- * Sets |meta| with size and state of the blob. Returns |blobState| with
- * standard definition from phosphor-ipmi-blobs header blob.hpp, plus OEM
- * flag bits BinaryStore::CommitState.
+ * Sets |meta| with size and state of the blob open in |session|. Returns
+ * |blobState| with standard definition from phosphor-ipmi-blobs header
+ * blob.hpp, plus OEM flag bits BinaryStore::CommitState.
 
 enum StateFlags
 {
@@ -488,38 +2216,35 @@ enum CommitState
     Dirty = (1 << 8), // In-memory data might not match persisted data
     Clean = (1 << 9), // In-memory data matches persisted data
     Uninitialized = (1 << 10), // Cannot find persisted data
-    CommitError = (1 << 11)    // Error happened during committing
+    CommitError = (1 << 11),   // Error happened during committing
+    ChecksumError = (1 << 12), // Persisted data failed its checksum
+    Loading = (1 << 13)        // Store is still being loaded
 };
 
 */
-bool BinaryStore::stat(blobs::BlobMeta* meta)
+bool BinaryStore::stat(uint16_t session, blobs::BlobMeta* meta)
 {
-    uint16_t blobState = blobs::StateFlags::open_read;
-    if (writable_)
+    auto it = sessions_.find(session);
+    if (it == sessions_.end())
     {
-        blobState |= blobs::StateFlags::open_write;
+        return false;
     }
 
-    if (commitState_ == CommitState::Clean)
-    {
-        blobState |= blobs::StateFlags::committed;
-    }
-    else if (commitState_ == CommitState::CommitError)
+    uint16_t blobState = blobs::StateFlags::open_read;
+    if (it->second.writable)
     {
-        blobState |= blobs::StateFlags::commit_error;
+        blobState |= blobs::StateFlags::open_write;
     }
-    blobState |= commitState_;
 
-    if (!currentBlob_.empty())
+    flushWriteBack(false);
+    finishAsyncCommit(false);
+    const auto& blob = sessionBlob(it->second);
+    if (blob.checksumError)
     {
-        meta->size = blobs_.find(currentBlob_)->second.size();
+        blobState |= CommitState::ChecksumError;
     }
-    else
-    {
-        meta->size = 0;
-    }
-    meta->blobState = blobState;
-
+    meta->size = blob.size();
+    meta->blobState = blobState | commitStateFlags();
     return true;
 }
 
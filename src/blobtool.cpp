@@ -25,6 +25,7 @@ struct BlobToolConfig
         LIST,
         READ,
         MIGRATE,
+        UPGRADE,
     } action = Action::LIST;
 } toolConfig;
 
@@ -38,6 +39,8 @@ void printUsage(const BlobToolConfig& cfg)
                    "becomes mandatory).\n"
                    "\t--migrate\tUpdate all binary stores to use the alias "
                    "blob id if enabled.\n"
+                   "\t--upgrade\tRewrite all binary stores in the flat (v2) "
+                   "format.\n"
                    "\t--config\tFILENAME\tPath to the configuration file. The "
                    "default is /usr/share/binaryblob/config.json.\n"
                    "\t--binary-store\tFILENAME\tPath to the binary storage. If "
@@ -58,6 +61,7 @@ bool parseOptions(int argc, char* argv[], BlobToolConfig& cfg)
         {"list", no_argument, nullptr, 'l'},
         {"read", no_argument, nullptr, 'r'},
         {"migrate", no_argument, nullptr, 'm'},
+        {"upgrade", no_argument, nullptr, 'u'},
         {"config", required_argument, nullptr, 'c'},
         {"binary-store", required_argument, nullptr, 's'},
         {"blob", required_argument, nullptr, 'b'},
@@ -88,6 +92,9 @@ bool parseOptions(int argc, char* argv[], BlobToolConfig& cfg)
             case 'm':
                 cfg.action = BlobToolConfig::Action::MIGRATE;
                 break;
+            case 'u':
+                cfg.action = BlobToolConfig::Action::UPGRADE;
+                break;
             case 'c':
                 cfg.configPath = optarg;
                 break;
@@ -131,8 +138,10 @@ int main(int argc, char* argv[])
             return 1;
         }
 
+        const bool readOnly =
+            toolConfig.action != BlobToolConfig::Action::UPGRADE;
         auto store =
-            binstore::BinaryStore::createFromFile(std::move(file), true);
+            binstore::BinaryStore::createFromFile(std::move(file), readOnly);
         stores.push_back(std::move(store));
     }
     else
@@ -176,9 +185,7 @@ int main(int argc, char* argv[])
             auto file = std::make_unique<binstore::SysFileImpl>(
                 config.sysFilePath, config.offsetBytes);
 
-            auto store = binstore::BinaryStore::createFromConfig(
-                config.blobBaseId, std::move(file), config.maxSizeBytes,
-                config.aliasBlobBaseId);
+            auto store = conf::createStore(config, std::move(file));
 
             if (toolConfig.action == BlobToolConfig::Action::MIGRATE)
             {
@@ -201,6 +208,44 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    if (toolConfig.action == BlobToolConfig::Action::UPGRADE)
+    {
+        int ret = 0;
+        for (const auto& store : stores)
+        {
+            /* Log engine stores have no image to upgrade */
+            auto* binaryStore =
+                dynamic_cast<binstore::BinaryStore*>(store.get());
+            if (!binaryStore)
+            {
+                if (store)
+                {
+                    stdplus::print(stderr, "Skipping {}, not an image store\n",
+                                   store->getBaseBlobId());
+                }
+                continue;
+            }
+            /* Whatever the storage holds isn't a store to convert */
+            blobs::BlobMeta meta;
+            if (binaryStore->stat(&meta) &&
+                (meta.blobState &
+                 binstore::BinaryStore::CommitState::Uninitialized))
+            {
+                stdplus::print(stderr, "Not upgrading {}, it holds no data\n",
+                               binaryStore->getBaseBlobId());
+                ret = 1;
+                continue;
+            }
+            if (!binaryStore->setImageFormat(binstore::ImageFormat::Flat))
+            {
+                stdplus::print(stderr, "Failed to upgrade {}\n",
+                               binaryStore->getBaseBlobId());
+                ret = 1;
+            }
+        }
+        return ret;
+    }
+
     if (toolConfig.action == BlobToolConfig::Action::LIST)
     {
         stdplus::print(stderr, "Supported Blobs: \n");
@@ -233,7 +278,7 @@ int main(int argc, char* argv[])
                                 return bn == toolConfig.blobName;
                             }))
             {
-                const auto blobData = store->readBlob(toolConfig.blobName);
+                const auto blobData = store->readBlobView(toolConfig.blobName);
                 if (blobData.empty())
                 {
                     stdplus::print(stderr, "No data read from {}\n",
@@ -243,9 +288,8 @@ int main(int argc, char* argv[])
 
                 blobFound = true;
 
-                std::copy(
-                    blobData.begin(), blobData.end(),
-                    std::ostream_iterator<decltype(blobData[0])>(std::cout));
+                std::cout.write(reinterpret_cast<const char*>(blobData.data()),
+                                blobData.size());
 
                 // It's assumed that the names of the blobs are unique within
                 // the system.
@@ -0,0 +1,155 @@
+#include "crc32c.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_acle.h>
+#endif
+
+namespace binstore
+{
+
+/* Reflected CRC32C polynomial */
+static constexpr uint32_t crc32cPoly = 0x82f63b78;
+
+/* Slicing-by-8 tables: crc32cTables[k][i] is the checksum of byte i followed
+ * by k zero bytes, so eight bytes can be folded in with eight lookups. */
+static constexpr auto crc32cTables = [] {
+    std::array<std::array<uint32_t, 256>, 8> tables = {};
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc >> 1) ^ (crc & 1 ? crc32cPoly : 0);
+        }
+        tables[0][i] = crc;
+    }
+    for (size_t k = 1; k < tables.size(); ++k)
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t prev = tables[k - 1][i];
+            tables[k][i] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+    return tables;
+}();
+
+static uint32_t loadLe32(const uint8_t* p)
+{
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 |
+           static_cast<uint32_t>(p[3]) << 24;
+}
+
+uint32_t crc32cPortable(std::span<const uint8_t> data, uint32_t crc)
+{
+    const auto& t = crc32cTables;
+    const uint8_t* p = data.data();
+    size_t len = data.size();
+
+    crc = ~crc;
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint32_t lo = crc ^ loadLe32(p);
+        uint32_t hi = loadLe32(p + 4);
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+              t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^ t[3][hi & 0xff] ^
+              t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+    for (; len > 0; ++p, --len)
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+
+/* SSE4.2 is not part of the x86-64 baseline, so it is checked at runtime */
+__attribute__((target("sse4.2"))) static uint32_t
+    crc32cHardware(std::span<const uint8_t> data, uint32_t crc)
+{
+    const uint8_t* p = data.data();
+    size_t len = data.size();
+
+    uint64_t crc64 = ~crc;
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    for (; len > 0; ++p, --len)
+    {
+        crc = _mm_crc32_u8(crc, *p);
+    }
+    return ~crc;
+}
+
+static bool hasHardwareCrc32c()
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(__ARM_FEATURE_CRC32) && !defined(__ARM_BIG_ENDIAN)
+
+/* The CRC extension is only used when the build targets it */
+static uint32_t crc32cHardware(std::span<const uint8_t> data, uint32_t crc)
+{
+    const uint8_t* p = data.data();
+    size_t len = data.size();
+
+    crc = ~crc;
+#if defined(__aarch64__)
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+#endif
+    for (; len >= 4; p += 4, len -= 4)
+    {
+        uint32_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc = __crc32cw(crc, word);
+    }
+    for (; len > 0; ++p, --len)
+    {
+        crc = __crc32cb(crc, *p);
+    }
+    return ~crc;
+}
+
+static bool hasHardwareCrc32c()
+{
+    return true;
+}
+
+#else
+
+static uint32_t crc32cHardware(std::span<const uint8_t> data, uint32_t crc)
+{
+    return crc32cPortable(data, crc);
+}
+
+static bool hasHardwareCrc32c()
+{
+    return false;
+}
+
+#endif
+
+uint32_t crc32c(std::span<const uint8_t> data, uint32_t crc)
+{
+    static const bool hardware = hasHardwareCrc32c();
+    return hardware ? crc32cHardware(data, crc) : crc32cPortable(data, crc);
+}
+
+} // namespace binstore
@@ -0,0 +1,215 @@
+#include "deferred_binarystore.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <ipmid/handler.hpp>
+#include <memory>
+#include <phosphor-logging/elog.hpp>
+#include <span>
+#include <string>
+#include <vector>
+
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+
+namespace binstore
+{
+
+using namespace phosphor::logging;
+
+DeferredBinaryStore::DeferredBinaryStore(
+    const std::string& baseBlobId,
+    std::future<std::unique_ptr<BinaryStoreInterface>> loading) :
+    baseBlobId_(baseBlobId), loading_(std::move(loading))
+{
+}
+
+std::unique_ptr<BinaryStoreInterface>
+    DeferredBinaryStore::createInBackground(const std::string& baseBlobId,
+                                            Loader load)
+{
+    if (baseBlobId.empty() || !load)
+    {
+        log<level::ERR>("Unable to defer loading binarystore: invalid config",
+                        entry("BASE_ID=%s", baseBlobId.c_str()));
+        return nullptr;
+    }
+
+    return std::make_unique<DeferredBinaryStore>(
+        baseBlobId, std::async(std::launch::async, std::move(load)));
+}
+
+bool DeferredBinaryStore::finishLoading(bool wait) const
+{
+    if (!loading_.valid())
+    {
+        return true;
+    }
+    if (!wait && loading_.wait_for(std::chrono::seconds(0)) !=
+                     std::future_status::ready)
+    {
+        return false;
+    }
+
+    try
+    {
+        store_ = loading_.get();
+    }
+    catch (const std::exception& e)
+    {
+        log<level::ERR>("Loading binarystore failed",
+                        entry("BASE_ID=%s", baseBlobId_.c_str()),
+                        entry("ERROR=%s", e.what()));
+    }
+    if (!store_)
+    {
+        log<level::ERR>("Deferred binarystore couldn't be loaded",
+                        entry("BASE_ID=%s", baseBlobId_.c_str()));
+    }
+    return true;
+}
+
+BinaryStoreInterface* DeferredBinaryStore::loadedStore() const
+{
+    finishLoading(true);
+    return store_.get();
+}
+
+std::string DeferredBinaryStore::getBaseBlobId() const
+{
+    return baseBlobId_;
+}
+
+bool DeferredBinaryStore::setBaseBlobId(const std::string& baseBlobId)
+{
+    auto* store = loadedStore();
+    if (!store || !store->setBaseBlobId(baseBlobId))
+    {
+        return false;
+    }
+    baseBlobId_ = baseBlobId;
+    return true;
+}
+
+std::vector<std::string> DeferredBinaryStore::getBlobIds() const
+{
+    /* Only the base id until loaded, which bumps the generation so the ids
+     * get listed again */
+    if (!finishLoading(false) || !store_)
+    {
+        return {baseBlobId_};
+    }
+    return store_->getBlobIds();
+}
+
+uint64_t DeferredBinaryStore::getBlobIdsGeneration() const
+{
+    /* Finishing the load changes the ids from whatever was listed before */
+    if (!finishLoading(false))
+    {
+        return 0;
+    }
+    return store_ ? store_->getBlobIdsGeneration() + 1 : 1;
+}
+
+bool DeferredBinaryStore::openOrCreateBlob(uint16_t session,
+                                           const std::string& blobId,
+                                           uint16_t flags)
+{
+    auto* store = loadedStore();
+    return store && store->openOrCreateBlob(session, blobId, flags);
+}
+
+bool DeferredBinaryStore::deleteBlob(const std::string& blobId)
+{
+    auto* store = loadedStore();
+    return store && store->deleteBlob(blobId);
+}
+
+std::span<const uint8_t> DeferredBinaryStore::readView(uint16_t session,
+                                                       uint32_t offset,
+                                                       uint32_t requestedSize)
+{
+    auto* store = loadedStore();
+    if (!store)
+    {
+        return {};
+    }
+    return store->readView(session, offset, requestedSize);
+}
+
+std::vector<uint8_t>
+    DeferredBinaryStore::readBlob(const std::string& blobId) const
+{
+    auto* store = loadedStore();
+    if (!store)
+    {
+        throw ipmi::HandlerCompletion(ipmi::ccUnspecifiedError);
+    }
+    return store->readBlob(blobId);
+}
+
+std::span<const uint8_t>
+    DeferredBinaryStore::readBlobView(const std::string& blobId)
+{
+    auto* store = loadedStore();
+    if (!store)
+    {
+        throw ipmi::HandlerCompletion(ipmi::ccUnspecifiedError);
+    }
+    return store->readBlobView(blobId);
+}
+
+bool DeferredBinaryStore::write(uint16_t session, uint32_t offset,
+                                std::span<const uint8_t> data)
+{
+    auto* store = loadedStore();
+    return store && store->write(session, offset, data);
+}
+
+bool DeferredBinaryStore::commit(uint16_t session)
+{
+    auto* store = loadedStore();
+    return store && store->commit(session);
+}
+
+bool DeferredBinaryStore::close(uint16_t session)
+{
+    auto* store = loadedStore();
+    return store && store->close(session);
+}
+
+bool DeferredBinaryStore::stat(blobs::BlobMeta* meta)
+{
+    if (!finishLoading(false))
+    {
+        meta->size = 0;
+        meta->blobState = CommitState::Loading;
+        return true;
+    }
+    return store_ && store_->stat(meta);
+}
+
+bool DeferredBinaryStore::statBlob(const std::string& blobId,
+                                   blobs::BlobMeta* meta)
+{
+    if (!finishLoading(false))
+    {
+        meta->size = 0;
+        meta->blobState = CommitState::Loading;
+        return true;
+    }
+    return store_ && store_->statBlob(blobId, meta);
+}
+
+bool DeferredBinaryStore::stat(uint16_t session, blobs::BlobMeta* meta)
+{
+    auto* store = loadedStore();
+    return store && store->stat(session, meta);
+}
+
+} // namespace binstore
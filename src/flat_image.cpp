@@ -0,0 +1,228 @@
+#include "flat_image.hpp"
+
+#include "crc32c.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+
+namespace binstore::flat
+{
+
+/* The header fields covered by |indexCrc| */
+static constexpr size_t crcStart = offsetof(Header, count);
+
+static uint32_t headerCrc(const Header& header)
+{
+    return crc32c({reinterpret_cast<const uint8_t*>(&header) + crcStart,
+                   sizeof(header) - crcStart});
+}
+
+bool isFlatImage(std::string_view prefix)
+{
+    boost::endian::little_uint32_t value;
+    if (prefix.size() < sizeof(value))
+    {
+        return false;
+    }
+    std::copy_n(prefix.data(), sizeof(value), reinterpret_cast<char*>(&value));
+    return value == magic;
+}
+
+size_t payloadStart(size_t baseIdSize, size_t count, size_t idsSize)
+{
+    return alignUp(sizeof(Header) + count * sizeof(Entry) + baseIdSize +
+                   idsSize);
+}
+
+std::optional<Index> readIndex(const SysFile& file)
+{
+    Header header;
+    if (file.readToBuf(0, sizeof(header), reinterpret_cast<char*>(&header)) !=
+            sizeof(header) ||
+        header.magic != magic || header.version != version)
+    {
+        return std::nullopt;
+    }
+
+    /* Sizes are checked before anything gets allocated from them */
+    const uint64_t tableSize = uint64_t{header.count} * sizeof(Entry);
+    const uint64_t indexSize = sizeof(header) + tableSize + header.baseIdSize +
+                               header.idsSize;
+    if (indexSize > header.imageSize ||
+        header.imageSize > std::numeric_limits<uint32_t>::max())
+    {
+        return std::nullopt;
+    }
+    const auto rest = file.readAsStr(sizeof(header),
+                                     indexSize - sizeof(header));
+    if (rest.size() != indexSize - sizeof(header) ||
+        crc32c(rest, headerCrc(header)) != header.indexCrc)
+    {
+        return std::nullopt;
+    }
+
+    Index index;
+    index.imageSize = header.imageSize;
+    index.indexSize = indexSize;
+    const std::string_view names = std::string_view(rest).substr(tableSize);
+    index.baseId = names.substr(0, header.baseIdSize);
+    const auto ids = names.substr(header.baseIdSize);
+    index.blobs.reserve(header.count);
+    for (uint32_t i = 0; i < header.count; ++i)
+    {
+        Entry entry;
+        std::copy_n(rest.data() + i * sizeof(entry), sizeof(entry),
+                    reinterpret_cast<char*>(&entry));
+        if (uint64_t{entry.idOffset} + entry.idSize > ids.size() ||
+            entry.offset < indexSize || entry.length > entry.capacity ||
+            uint64_t{entry.offset} + entry.capacity > header.imageSize)
+        {
+            return std::nullopt;
+        }
+        Extent extent = {
+            .id = std::string(ids.substr(entry.idOffset, entry.idSize)),
+            .offset = entry.offset,
+            .length = entry.length,
+            .capacity = entry.capacity,
+            .crc = entry.crc,
+        };
+        /* Lookups rely on the order */
+        if (!index.blobs.empty() && index.blobs.back().id >= extent.id)
+        {
+            return std::nullopt;
+        }
+        index.blobs.push_back(std::move(extent));
+    }
+    return index;
+}
+
+size_t place(std::string_view baseId, std::vector<Extent>& blobs,
+             size_t maxSize)
+{
+    size_t idsSize = 0, packedSize = 0;
+    for (const auto& blob : blobs)
+    {
+        idsSize += blob.id.size();
+        packedSize += alignUp(blob.length);
+    }
+    const size_t start = payloadStart(baseId.size(), blobs.size(), idsSize);
+    packedSize += start;
+
+    auto pack = [&] {
+        size_t end = start;
+        for (auto& blob : blobs)
+        {
+            blob.offset = end;
+            blob.capacity = alignUp(blob.length);
+            end += blob.capacity;
+        }
+        return end;
+    };
+
+    size_t end = start;
+    for (const auto& blob : blobs)
+    {
+        if (blob.offset != 0)
+        {
+            if (blob.offset < start)
+            {
+                return pack();
+            }
+            end = std::max<size_t>(end, blob.offset + blob.capacity);
+        }
+    }
+    for (auto& blob : blobs)
+    {
+        if (blob.offset == 0 || blob.length > blob.capacity)
+        {
+            blob.offset = end;
+            blob.capacity = alignUp(blob.length);
+            end += blob.capacity;
+        }
+    }
+
+    /* Space left behind by moved or deleted payloads is only reclaimed by
+     * packing, once it makes up half of the image */
+    if (end > maxSize || end > 2 * packedSize)
+    {
+        return pack();
+    }
+    return end;
+}
+
+std::string encodeIndex(std::string_view baseId,
+                        const std::vector<Extent>& blobs, size_t imageSize)
+{
+    size_t idsSize = 0;
+    for (const auto& blob : blobs)
+    {
+        idsSize += blob.id.size();
+    }
+
+    std::string index(payloadStart(baseId.size(), blobs.size(), idsSize),
+                      '\0');
+    char* names = index.data() + sizeof(Header) + blobs.size() * sizeof(Entry);
+    std::copy(baseId.begin(), baseId.end(), names);
+    char* ids = names + baseId.size();
+    size_t idOffset = 0;
+    for (size_t i = 0; i < blobs.size(); ++i)
+    {
+        const auto& blob = blobs[i];
+        if (blob.offset < index.size() || blob.length > blob.capacity ||
+            blob.offset + blob.capacity > imageSize)
+        {
+            throw std::runtime_error("Blob doesn't match its placement");
+        }
+
+        Entry entry;
+        entry.idOffset = idOffset;
+        entry.idSize = blob.id.size();
+        entry.offset = blob.offset;
+        entry.length = blob.length;
+        entry.capacity = blob.capacity;
+        entry.crc = blob.crc;
+        std::copy_n(reinterpret_cast<const char*>(&entry), sizeof(entry),
+                    index.data() + sizeof(Header) + i * sizeof(entry));
+        std::copy(blob.id.begin(), blob.id.end(), ids + idOffset);
+        idOffset += blob.id.size();
+    }
+
+    Header header;
+    header.magic = magic;
+    header.version = version;
+    header.alignment = alignment;
+    header.count = blobs.size();
+    header.baseIdSize = baseId.size();
+    header.idsSize = idsSize;
+    header.imageSize = imageSize;
+    const size_t indexEnd = ids + idsSize - index.data();
+    header.indexCrc = crc32c(
+        std::string_view(index).substr(sizeof(header),
+                                       indexEnd - sizeof(header)),
+        headerCrc(header));
+    std::copy_n(reinterpret_cast<const char*>(&header), sizeof(header),
+                index.data());
+    return index;
+}
+
+std::string encode(
+    std::string_view baseId, const std::vector<Extent>& blobs, size_t imageSize,
+    const std::function<std::span<const uint8_t>(size_t)>& payload)
+{
+    std::string image = encodeIndex(baseId, blobs, imageSize);
+    image.resize(imageSize, '\0');
+    for (size_t i = 0; i < blobs.size(); ++i)
+    {
+        const auto data = payload(i);
+        if (data.size() != blobs[i].length)
+        {
+            throw std::runtime_error("Blob doesn't match its placement");
+        }
+        std::copy(data.begin(), data.end(), image.data() + blobs[i].offset);
+    }
+    return image;
+}
+
+} // namespace binstore::flat
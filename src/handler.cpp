@@ -1,9 +1,10 @@
 #include "handler.hpp"
 
-#include <algorithm>
 #include <cstdint>
+#include <iterator>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 using std::size_t;
@@ -23,9 +24,10 @@ namespace internal
  * @param blobId: Input blob id which is expected to only contain alphanumerical
  *                characters and '/'.
  * @returns: the baseId containing the blobId, stripping all contents from the
- *           last '/'. If no '/' is present, an empty string is returned.
+ *           last '/'. If no '/' is present, an empty string is returned. The
+ *           view refers to |blobId|.
  */
-static std::string getBaseFromId(const std::string& blobId)
+static std::string_view getBaseFromId(std::string_view blobId)
 {
     return blobId.substr(0, blobId.find_last_of('/') + 1);
 }
@@ -37,87 +39,159 @@ void BinaryStoreBlobHandler::addNewBinaryStore(
 {
     // TODO: this is a very rough measure to test the mock interface for now.
     stores_[store->getBaseBlobId()] = std::move(store);
+    blobIdsStamp_.reset();
+}
+
+bool BinaryStoreBlobHandler::setBaseBlobId(const std::string& baseId,
+                                           const std::string& newBaseId)
+{
+    auto* store = findStore(baseId);
+    if (!store || findStore(newBaseId))
+    {
+        return false;
+    }
+
+    if (!store->setBaseBlobId(newBaseId))
+    {
+        return false;
+    }
+
+    auto node = stores_.extract(baseId);
+    node.key() = newBaseId;
+    stores_.insert(std::move(node));
+    blobIdsStamp_.reset();
+    return true;
+}
+
+binstore::BinaryStoreInterface*
+    BinaryStoreBlobHandler::findStore(std::string_view base)
+{
+    auto it = stores_.find(base);
+    if (it != stores_.end() && it->second->getBaseBlobId() == it->first)
+    {
+        return it->second.get();
+    }
+
+    /* Either missed or keyed by an old id: the store was renamed without
+     * going through setBaseBlobId(), so key every store by its id again. */
+    rekeyStores();
+    it = stores_.find(base);
+    return it == stores_.end() ? nullptr : it->second.get();
+}
+
+void BinaryStoreBlobHandler::rekeyStores()
+{
+    for (auto it = stores_.begin(); it != stores_.end();)
+    {
+        auto curr = it++;
+        auto baseId = curr->second->getBaseBlobId();
+        if (baseId == curr->first)
+        {
+            continue;
+        }
+
+        auto node = stores_.extract(curr);
+        auto oldId = std::move(node.key());
+        node.key() = std::move(baseId);
+        auto result = stores_.insert(std::move(node));
+        if (!result.inserted)
+        {
+            /* Another store already has this id, keep the old route */
+            result.node.key() = std::move(oldId);
+            stores_.insert(std::move(result.node));
+        }
+        blobIdsStamp_.reset();
+    }
 }
 
 bool BinaryStoreBlobHandler::canHandleBlob(const std::string& path)
 {
-    auto base = internal::getBaseFromId(path);
+    const auto base = internal::getBaseFromId(path);
     if (base.empty() || base == path)
     {
         /* Operations on baseId itself or an empty base is not allowed */
         return false;
     }
 
-    return std::any_of(stores_.begin(), stores_.end(),
-                       [&](const auto& baseStorePair) {
-                           return base == baseStorePair.second->getBaseBlobId();
-                       });
+    return findStore(base) != nullptr;
 }
 
 std::vector<std::string> BinaryStoreBlobHandler::getBlobIds()
 {
-    std::vector<std::string> result;
+    /* Generations only grow, so their sum changes with any of them */
+    uint64_t stamp = 0;
+    for (const auto& baseStorePair : stores_)
+    {
+        stamp += baseStorePair.second->getBlobIdsGeneration();
+    }
+    if (blobIdsStamp_ == stamp)
+    {
+        return blobIds_;
+    }
 
+    blobIds_.clear();
     for (const auto& baseStorePair : stores_)
     {
-        const auto& ids = baseStorePair.second->getBlobIds();
-        result.insert(result.end(), ids.begin(), ids.end());
+        auto ids = baseStorePair.second->getBlobIds();
+        blobIds_.insert(blobIds_.end(), std::make_move_iterator(ids.begin()),
+                        std::make_move_iterator(ids.end()));
     }
+    blobIdsStamp_ = stamp;
 
-    return result;
+    return blobIds_;
 }
 
 bool BinaryStoreBlobHandler::deleteBlob(const std::string& path)
 {
-    auto it = stores_.find(internal::getBaseFromId(path));
-    if (it == stores_.end())
+    auto* store = findStore(internal::getBaseFromId(path));
+    if (!store)
     {
         return false;
     }
 
-    return it->second->deleteBlob(path);
+    return store->deleteBlob(path);
 }
 
 bool BinaryStoreBlobHandler::stat(const std::string& path,
                                   struct BlobMeta* meta)
 {
-    auto it = stores_.find(internal::getBaseFromId(path));
-    if (it == stores_.end())
+    auto* store = findStore(internal::getBaseFromId(path));
+    if (!store)
     {
         return false;
     }
 
-    return it->second->stat(meta);
+    return store->statBlob(path, meta);
 }
 
 bool BinaryStoreBlobHandler::open(uint16_t session, uint16_t flags,
                                   const std::string& path)
 {
-    if (!canHandleBlob(path))
+    if (sessions_.find(session))
     {
+        /* This session is already active */
         return false;
     }
 
-    auto found = sessions_.find(session);
-    if (found != sessions_.end())
+    /* Same checks as canHandleBlob(), resolving the store only once */
+    const auto base = internal::getBaseFromId(path);
+    if (base.empty() || base == path)
     {
-        /* This session is already active */
         return false;
     }
 
-    const auto& base = internal::getBaseFromId(path);
-
-    if (stores_.find(base) == stores_.end())
+    auto* store = findStore(base);
+    if (!store)
     {
         return false;
     }
 
-    if (!stores_[base]->openOrCreateBlob(path, flags))
+    if (!store->openOrCreateBlob(session, path, flags))
     {
         return false;
     }
 
-    sessions_[session] = stores_[base].get();
+    sessions_.insert(session, store);
     return true;
 }
 
@@ -125,25 +199,25 @@ std::vector<uint8_t> BinaryStoreBlobHandler::read(uint16_t session,
                                                   uint32_t offset,
                                                   uint32_t requestedSize)
 {
-    auto it = sessions_.find(session);
-    if (it == sessions_.end())
+    auto* store = sessions_.find(session);
+    if (!store)
     {
         return std::vector<uint8_t>();
     }
 
-    return it->second->read(offset, requestedSize);
+    return store->read(session, offset, requestedSize);
 }
 
 bool BinaryStoreBlobHandler::write(uint16_t session, uint32_t offset,
                                    const std::vector<uint8_t>& data)
 {
-    auto it = sessions_.find(session);
-    if (it == sessions_.end())
+    auto* store = sessions_.find(session);
+    if (!store)
     {
         return false;
     }
 
-    return it->second->write(offset, data);
+    return store->write(session, offset, data);
 }
 
 bool BinaryStoreBlobHandler::writeMeta(uint16_t, uint32_t,
@@ -156,41 +230,39 @@ bool BinaryStoreBlobHandler::writeMeta(uint16_t, uint32_t,
 bool BinaryStoreBlobHandler::commit(uint16_t session,
                                     const std::vector<uint8_t>&)
 {
-    auto it = sessions_.find(session);
-    if (it == sessions_.end())
+    auto* store = sessions_.find(session);
+    if (!store)
     {
         return false;
     }
 
-    return it->second->commit();
+    return store->commit(session);
 }
 
 bool BinaryStoreBlobHandler::close(uint16_t session)
 {
-    auto it = sessions_.find(session);
-    if (it == sessions_.end())
-    {
-        return false;
-    }
-
-    if (!it->second->close())
+    auto* store = sessions_.find(session);
+    if (!store)
     {
         return false;
     }
 
+    /* The session ends even if the store reports an error closing it, such
+     * as a failed write of the commits held back for it */
+    const bool closed = store->close(session);
     sessions_.erase(session);
-    return true;
+    return closed;
 }
 
 bool BinaryStoreBlobHandler::stat(uint16_t session, struct BlobMeta* meta)
 {
-    auto it = sessions_.find(session);
-    if (it == sessions_.end())
+    auto* store = sessions_.find(session);
+    if (!store)
     {
         return false;
     }
 
-    return it->second->stat(meta);
+    return store->stat(session, meta);
 }
 
 bool BinaryStoreBlobHandler::expire(uint16_t session)
@@ -0,0 +1,844 @@
+#include "log_binarystore.hpp"
+
+#include "crc32c.hpp"
+#include "sys_file.hpp"
+
+#include <algorithm>
+#include <array>
+#include <blobs-ipmid/blobs.hpp>
+#include <boost/endian/arithmetic.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <ipmid/handler.hpp>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <phosphor-logging/elog.hpp>
+#include <span>
+#include <stdexcept>
+#include <stdplus/str/cat.hpp>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+using std::size_t;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+
+namespace binstore
+{
+
+using namespace phosphor::logging;
+
+/* One of the two headers at the start of the sysfile, each pointing to the
+ * records of a base. The one with the newest epoch and an intact base is
+ * current. */
+struct LogHeader
+{
+    boost::endian::little_uint32_t magic;
+    /* CRC32C of the fields below */
+    boost::endian::little_uint32_t headerCrc;
+    boost::endian::little_uint64_t epoch;
+    /* Sysfile positions where the base starts, and where it ends and
+     * appended records start */
+    boost::endian::little_uint64_t baseStart;
+    boost::endian::little_uint64_t baseEnd;
+};
+
+/* Bases are written past both headers */
+static constexpr size_t headersSize = 2 * sizeof(LogHeader);
+
+/* Header of every record, followed by the blob id and the data */
+struct RecordHeader
+{
+    /* CRC32C of the fields below, the id and the data, continuing the CRC of
+     * the previous record (or the header for the first one) */
+    boost::endian::little_uint32_t crc;
+    boost::endian::little_uint64_t epoch;
+    boost::endian::little_uint8_t type;
+    boost::endian::little_uint8_t reserved;
+    boost::endian::little_uint16_t idSize;
+    boost::endian::little_uint32_t offset;
+    boost::endian::little_uint32_t dataSize;
+};
+
+static constexpr uint32_t logMagic = 0x474c5342; // "BSLG" on disk
+
+enum RecordType : uint8_t
+{
+    /* Sets the base blob id, held in the id field */
+    baseIdRecord = 1,
+    /* Writes the data at offset into the blob, creating the blob if needed */
+    writeRecord = 2,
+    /* Removes the blob, until compaction drops the record and the blob */
+    deleteRecord = 3,
+};
+
+template <typename T>
+static std::string_view bytesAfter(const T& header, size_t start)
+{
+    return {reinterpret_cast<const char*>(&header) + start,
+            sizeof(header) - start};
+}
+
+static uint32_t logHeaderCrc(const LogHeader& header)
+{
+    return crc32c(bytesAfter(header, offsetof(LogHeader, epoch)));
+}
+
+static constexpr size_t recordSize(size_t idSize, size_t dataSize)
+{
+    return sizeof(RecordHeader) + idSize + dataSize;
+}
+
+/* CRC of a record with the id and data |body|, following a record with the
+ * CRC |prevCrc| */
+static uint32_t recordCrc(const RecordHeader& header, std::string_view body,
+                          uint32_t prevCrc)
+{
+    auto fields = bytesAfter(header, offsetof(RecordHeader, epoch));
+    return crc32c(body, crc32c(fields, prevCrc));
+}
+
+/* Encode a record following a record with the CRC |prevCrc| */
+static std::string encodeRecord(uint64_t epoch, uint32_t prevCrc, uint8_t type,
+                                std::string_view id, uint32_t offset,
+                                std::span<const uint8_t> data)
+{
+    RecordHeader header;
+    header.epoch = epoch;
+    header.type = type;
+    header.reserved = 0;
+    header.idSize = id.size();
+    header.offset = offset;
+    header.dataSize = data.size();
+
+    std::string record;
+    record.reserve(recordSize(id.size(), data.size()));
+    record.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    record.append(id);
+    record.append(reinterpret_cast<const char*>(data.data()), data.size());
+    header.crc = recordCrc(
+        header, std::string_view(record).substr(sizeof(header)), prevCrc);
+    std::copy_n(reinterpret_cast<const char*>(&header), sizeof(header.crc),
+                record.data());
+    return record;
+}
+
+LogBinaryStore::LogBinaryStore(const std::string& baseBlobId,
+                               std::unique_ptr<SysFile> file,
+                               std::optional<uint32_t> maxSize,
+                               const StoreOptions& options) :
+    baseBlobId_(baseBlobId), file_(std::move(file)), maxSize(maxSize),
+    options_(options)
+{
+    recalcCompactSize();
+}
+
+std::unique_ptr<BinaryStoreInterface> LogBinaryStore::createFromConfig(
+    const std::string& baseBlobId, std::unique_ptr<SysFile> file,
+    std::optional<uint32_t> maxSize, const StoreOptions& options)
+{
+    if (baseBlobId.empty() || !file ||
+        baseBlobId.size() > std::numeric_limits<uint16_t>::max())
+    {
+        log<level::ERR>("Unable to create log binarystore from invalid config",
+                        entry("BASE_ID=%s", baseBlobId.c_str()));
+        return nullptr;
+    }
+
+    auto store = std::make_unique<LogBinaryStore>(baseBlobId, std::move(file),
+                                                  maxSize, options);
+
+    if (!store->loadLog())
+    {
+        return nullptr;
+    }
+
+    return store;
+}
+
+bool LogBinaryStore::loadLog()
+{
+    /* Replay the log if we know it might not match what we have.
+     * Note it will overwrite existing unsaved data per design. */
+    if (commitState_ == CommitState::Clean ||
+        commitState_ == CommitState::Uninitialized)
+    {
+        return true;
+    }
+
+    blobs_.clear();
+    pendingLog_.clear();
+    ++blobIdsGeneration_;
+    std::optional<std::string> loadedBaseId;
+    commitState_ = CommitState::Uninitialized;
+    try
+    {
+        std::array<LogHeader, 2> headers;
+        const size_t headersRead = file_->readToBuf(
+            0, sizeof(headers), reinterpret_cast<char*>(headers.data()));
+        std::vector<const LogHeader*> valid;
+        for (size_t i = 0; i < headers.size(); ++i)
+        {
+            const auto& header = headers[i];
+            if (headersRead >= (i + 1) * sizeof(header) &&
+                header.magic == logMagic &&
+                header.headerCrc == logHeaderCrc(header) &&
+                header.baseStart >= headersSize &&
+                header.baseEnd >= header.baseStart)
+            {
+                valid.push_back(&header);
+            }
+        }
+
+        /* An interrupted compaction leaves the newest header pointing to a
+         * base that isn't intact, or not updated at all. Either way the other
+         * header still points to the previous base. */
+        std::sort(valid.begin(), valid.end(), [](const auto* a, const auto* b) {
+            return a->epoch > b->epoch;
+        });
+        for (const auto* header : valid)
+        {
+            try
+            {
+                if (replay(*header, loadedBaseId))
+                {
+                    commitState_ = CommitState::Clean;
+                    break;
+                }
+            }
+            catch (const std::system_error&)
+            {
+                throw;
+            }
+            catch (const std::exception&)
+            {
+                /* Non system error originates from a junk record size */
+            }
+            blobs_.clear();
+            loadedBaseId.reset();
+        }
+        if (commitState_ == CommitState::Uninitialized && !valid.empty())
+        {
+            /* Newer epochs have to outdate whatever the headers hold */
+            epoch_ = valid.front()->epoch;
+        }
+    }
+    catch (const std::system_error& e)
+    {
+        /* Read causes unexpected system-level failure */
+        log<level::ERR>("Reading from sysfile failed",
+                        entry("ERROR=%s", e.what()));
+        commitState_ = CommitState::Dirty;
+        return false;
+    }
+
+    pendingCrc_ = logCrc_;
+    if (commitState_ == CommitState::Uninitialized)
+    {
+        log<level::WARNING>("Fail to replay. There might be no persisted blobs",
+                            entry("BASE_ID=%s", baseBlobId_.c_str()));
+        baseStart_ = baseEnd_ = logEnd_ = 0;
+        recalcCompactSize();
+        return true;
+    }
+
+    recalcCompactSize();
+    if (loadedBaseId != baseBlobId_)
+    {
+        /* Uh oh, stale data loaded. Clean it and commit. */
+        log<level::ERR>("Stale blob data, resetting internals...",
+                        entry("LOADED=%s", loadedBaseId.value_or("").c_str()),
+                        entry("EXPECTED=%s", baseBlobId_.c_str()));
+        blobs_.clear();
+        recalcCompactSize();
+        commitState_ = CommitState::Dirty;
+        return persist(true);
+    }
+    return true;
+}
+
+bool LogBinaryStore::replay(const LogHeader& header,
+                            std::optional<std::string>& loadedBaseId)
+{
+    epoch_ = header.epoch;
+    baseStart_ = header.baseStart;
+    baseEnd_ = header.baseEnd;
+    logCrc_ = header.headerCrc;
+
+    /* Replay up to the first record that isn't intact, which is where an
+     * interrupted append stopped */
+    size_t pos = baseStart_;
+    while (true)
+    {
+        RecordHeader record;
+        if (file_->readToBuf(pos, sizeof(record),
+                             reinterpret_cast<char*>(&record)) !=
+                sizeof(record) ||
+            record.epoch != epoch_)
+        {
+            break;
+        }
+        const size_t idSize = record.idSize;
+        const size_t dataSize = record.dataSize;
+        auto body = file_->readAsStr(pos + sizeof(record), idSize + dataSize);
+        if (body.size() != idSize + dataSize ||
+            record.crc != recordCrc(record, body, logCrc_))
+        {
+            break;
+        }
+
+        auto id = body.substr(0, idSize);
+        if (record.type == RecordType::baseIdRecord)
+        {
+            loadedBaseId = std::move(id);
+        }
+        else if (record.type != RecordType::writeRecord &&
+                 record.type != RecordType::deleteRecord)
+        {
+            break;
+        }
+        else if (!loadedBaseId || !id.starts_with(*loadedBaseId))
+        {
+            /* Blobs are keyed relative to the base id */
+            log<level::WARNING>("Dropping blob outside of the base id",
+                                entry("BLOB_ID=%s", id.c_str()));
+        }
+        else if (record.type == RecordType::writeRecord)
+        {
+            auto& blob = blobs_[id.substr(loadedBaseId->size())];
+            if (record.offset > blob.size())
+            {
+                break;
+            }
+            blob.resize(
+                std::max<size_t>(blob.size(), record.offset + dataSize));
+            std::copy(body.begin() + idSize, body.end(),
+                      blob.begin() + record.offset);
+        }
+        else
+        {
+            blobs_.erase(id.substr(loadedBaseId->size()));
+        }
+        logCrc_ = record.crc;
+        pos += recordSize(idSize, dataSize);
+    }
+    logEnd_ = pos;
+
+    /* Only appended records can be cut short, a broken base is as unusable
+     * as a broken image */
+    return logEnd_ >= baseEnd_;
+}
+
+void LogBinaryStore::recalcCompactSize()
+{
+    compactSize_ = recordSize(baseBlobId_.size(), 0);
+    for (const auto& [id, data] : blobs_)
+    {
+        compactSize_ += recordSize(baseBlobId_.size() + id.size(), data.size());
+    }
+}
+
+size_t LogBinaryStore::maxBaseSize() const
+{
+    if (!maxSize)
+    {
+        return std::numeric_limits<size_t>::max();
+    }
+    return (std::max<size_t>(*maxSize, headersSize) - headersSize) / 2;
+}
+
+std::optional<std::string_view>
+    LogBinaryStore::relativeId(std::string_view blobId) const
+{
+    if (!blobId.starts_with(baseBlobId_))
+    {
+        return std::nullopt;
+    }
+    return blobId.substr(baseBlobId_.size());
+}
+
+void LogBinaryStore::appendRecord(uint8_t type, const std::string& id,
+                                  uint32_t offset,
+                                  std::span<const uint8_t> data)
+{
+    auto record = encodeRecord(epoch_, pendingCrc_, type, id, offset, data);
+    pendingCrc_ = *reinterpret_cast<const boost::endian::little_uint32_t*>(
+        record.data());
+    pendingLog_ += record;
+}
+
+std::string LogBinaryStore::getBaseBlobId() const
+{
+    return baseBlobId_;
+}
+
+bool LogBinaryStore::setBaseBlobId(const std::string& baseBlobId)
+{
+    if (baseBlobId.size() > std::numeric_limits<uint16_t>::max())
+    {
+        return false;
+    }
+
+    /* Blobs are keyed relative to the base id and don't change, only the
+     * records do */
+    for (auto& [id, session] : sessions_)
+    {
+        if (session.blobId.starts_with(baseBlobId_))
+        {
+            session.blobId = stdplus::strCat(
+                baseBlobId,
+                std::string_view(session.blobId).substr(baseBlobId_.size()));
+        }
+    }
+    baseBlobId_ = baseBlobId;
+    recalcCompactSize();
+    commitState_ = CommitState::Dirty;
+    ++blobIdsGeneration_;
+    /* Renaming every blob is cheaper as a fresh base than as records */
+    return persist(true);
+}
+
+std::vector<std::string> LogBinaryStore::getBlobIds() const
+{
+    std::vector<std::string> result;
+    result.reserve(blobs_.size() + 1);
+    result.emplace_back(getBaseBlobId());
+    for (const auto& kv : blobs_)
+    {
+        result.emplace_back(stdplus::strCat(baseBlobId_, kv.first));
+    }
+    return result;
+}
+
+uint64_t LogBinaryStore::getBlobIdsGeneration() const
+{
+    return blobIdsGeneration_;
+}
+
+bool LogBinaryStore::openOrCreateBlob(uint16_t session,
+                                      const std::string& blobId,
+                                      uint16_t flags)
+{
+    if (!(flags & blobs::OpenFlags::read))
+    {
+        log<level::ERR>("OpenFlags::read not specified when opening",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    if (sessions_.contains(session))
+    {
+        log<level::ERR>("Session already has a blob open",
+                        entry("SESSION=%d", session),
+                        entry("RECEIVED=%s", blobId.c_str()));
+        return false;
+    }
+
+    const bool writable = flags & blobs::OpenFlags::write;
+    if (writable && std::any_of(sessions_.begin(), sessions_.end(),
+                                [&](const auto& s) {
+                                    return s.second.writable &&
+                                           s.second.blobId == blobId;
+                                }))
+    {
+        log<level::ERR>("Blob is already open for writing",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    /* If there are uncommitted data no other session works on, discard
+     * them. */
+    if (sessions_.empty() && !this->loadLog())
+    {
+        return false;
+    }
+
+    const auto id = relativeId(blobId);
+    if (!id)
+    {
+        log<level::ERR>("Blob id outside of the base id",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+    if (blobs_.find(*id) != blobs_.end())
+    {
+        sessions_[session] = {blobId, writable};
+        return true;
+    }
+
+    /* Otherwise, create the blob with an empty write */
+    if (blobId.size() > std::numeric_limits<uint16_t>::max())
+    {
+        log<level::ERR>("Blob id too long",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+    if (compactSize_ + recordSize(blobId.size(), 0) > maxBaseSize())
+    {
+        log<level::ERR>("Creating the blob would make the total size exceed "
+                        "the max size allowed",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+    blobs_.emplace(*id, std::vector<uint8_t>{});
+    compactSize_ += recordSize(blobId.size(), 0);
+    appendRecord(RecordType::writeRecord, blobId, 0, {});
+    sessions_[session] = {blobId, writable};
+    commitState_ = CommitState::Dirty;
+    ++blobIdsGeneration_;
+    return true;
+}
+
+bool LogBinaryStore::deleteBlob(const std::string& blobId)
+{
+    if (std::any_of(sessions_.begin(), sessions_.end(), [&](const auto& s) {
+            return s.second.blobId == blobId;
+        }))
+    {
+        log<level::ERR>("Can't delete an open blob",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    if (sessions_.empty())
+    {
+        /* If there are uncommitted data, discard them. */
+        if (!this->loadLog())
+        {
+            return false;
+        }
+    }
+    else if (!pendingLog_.empty())
+    {
+        /* Committing the deletion would also commit the open sessions'
+         * writes */
+        log<level::ERR>("Can't delete while open sessions have uncommitted "
+                        "changes",
+                        entry("BLOB_ID=%s", blobId.c_str()));
+        return false;
+    }
+
+    const auto id = relativeId(blobId);
+    auto it = id ? blobs_.find(*id) : blobs_.end();
+    if (it == blobs_.end())
+    {
+        return false;
+    }
+
+    /* Append a tombstone, the blob data is only dropped from the sysfile by
+     * the next compaction */
+    compactSize_ -= recordSize(blobId.size(), it->second.size());
+    blobs_.erase(it);
+    appendRecord(RecordType::deleteRecord, blobId, 0, {});
+    commitState_ = CommitState::Dirty;
+    ++blobIdsGeneration_;
+    return persist(false);
+}
+
+std::span<const uint8_t> LogBinaryStore::readView(uint16_t session,
+                                                  uint32_t offset,
+                                                  uint32_t requestedSize)
+{
+    auto it = sessions_.find(session);
+    if (it == sessions_.end())
+    {
+        log<level::ERR>("No open blob to read", entry("SESSION=%d", session));
+        return {};
+    }
+
+    const std::span<const uint8_t> data =
+        blobs_.find(*relativeId(it->second.blobId))->second;
+
+    /* If it is out of bound, return an empty view */
+    if (offset >= data.size())
+    {
+        log<level::ERR>("Read offset is beyond data size",
+                        entry("MAX_SIZE=0x%x", data.size()),
+                        entry("RECEIVED_OFFSET=0x%x", offset));
+        return {};
+    }
+
+    return data.subspan(offset, std::min<size_t>(requestedSize,
+                                                 data.size() - offset));
+}
+
+std::vector<uint8_t> LogBinaryStore::readBlob(const std::string& blobId) const
+{
+    const auto id = relativeId(blobId);
+    const auto blobIt = id ? blobs_.find(*id) : blobs_.end();
+    if (blobIt == blobs_.end())
+    {
+        throw ipmi::HandlerCompletion(ipmi::ccUnspecifiedError);
+    }
+    return blobIt->second;
+}
+
+std::span<const uint8_t> LogBinaryStore::readBlobView(const std::string& blobId)
+{
+    const auto id = relativeId(blobId);
+    const auto blobIt = id ? blobs_.find(*id) : blobs_.end();
+    if (blobIt == blobs_.end())
+    {
+        throw ipmi::HandlerCompletion(ipmi::ccUnspecifiedError);
+    }
+    return blobIt->second;
+}
+
+bool LogBinaryStore::write(uint16_t session, uint32_t offset,
+                           std::span<const uint8_t> data)
+{
+    auto it = sessions_.find(session);
+    if (it == sessions_.end())
+    {
+        log<level::ERR>("No open blob to write", entry("SESSION=%d", session));
+        return false;
+    }
+
+    if (!it->second.writable)
+    {
+        log<level::ERR>("Open blob is not writable");
+        return false;
+    }
+
+    const auto& blobId = it->second.blobId;
+    auto& bdata = blobs_.find(*relativeId(blobId))->second;
+    if (offset > bdata.size())
+    {
+        log<level::ERR>("Write would leave a gap with undefined data. Return.");
+        return false;
+    }
+
+    /* Rewriting identical bytes doesn't need to be committed again */
+    if (offset + data.size() <= bdata.size() &&
+        std::equal(data.begin(), data.end(), bdata.begin() + offset))
+    {
+        return true;
+    }
+
+    /* The log can always be compacted, so only the compacted size has to
+     * fit, next to the previous base */
+    size_t reqSize = std::max<size_t>(bdata.size(), offset + data.size());
+    size_t newSize = compactSize_ - recordSize(blobId.size(), bdata.size()) +
+                     recordSize(blobId.size(), reqSize);
+    if (newSize > maxBaseSize())
+    {
+        log<level::ERR>("Write data would make the total size exceed the max "
+                        "size allowed. Return.");
+        return false;
+    }
+
+    bdata.resize(reqSize);
+    std::copy(data.begin(), data.end(), bdata.data() + offset);
+    compactSize_ = newSize;
+    appendRecord(RecordType::writeRecord, blobId, offset, data);
+    commitState_ = CommitState::Dirty;
+    return true;
+}
+
+bool LogBinaryStore::commit(uint16_t session)
+{
+    if (!sessions_.contains(session))
+    {
+        log<level::ERR>("No open blob to commit", entry("SESSION=%d", session));
+        return false;
+    }
+
+    return persist(false);
+}
+
+bool LogBinaryStore::persist(bool compaction)
+{
+    if (commitState_ == CommitState::Clean)
+    {
+        return true;
+    }
+
+    const size_t limit = maxSize.value_or(
+        std::numeric_limits<std::decay_t<decltype(*maxSize)>>::max());
+    const size_t logSize = logEnd_ - baseEnd_ + pendingLog_.size();
+    /* The log of a base at the front leaves room for the next base after
+     * it, while the front is free again for the one after a base past it */
+    const size_t reserved = maxSize && baseStart_ == headersSize
+                                ? maxBaseSize()
+                                : 0;
+    /* By default, compact once more was appended than the base holds */
+    compaction = compaction || logEnd_ == 0 ||
+                 logEnd_ + pendingLog_.size() + reserved > limit ||
+                 logSize > options_.logCompactionThreshold.value_or(
+                               baseEnd_ - baseStart_);
+    try
+    {
+        if (compaction)
+        {
+            compact();
+        }
+        else
+        {
+            file_->writeStr(pendingLog_, logEnd_);
+            logEnd_ += pendingLog_.size();
+            logCrc_ = pendingCrc_;
+            ++commitStats_.commits;
+            commitStats_.bytesWritten += pendingLog_.size();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        commitState_ = CommitState::CommitError;
+        log<level::ERR>("Writing to sysfile failed",
+                        entry("ERROR=%s", e.what()));
+        return false;
+    }
+
+    pendingLog_.clear();
+    commitState_ = CommitState::Clean;
+    return true;
+}
+
+void LogBinaryStore::compact()
+{
+    /* Never overwrite the current base or its log: use the front if the base
+     * fits before them, or else the space past them. A base past them starts
+     * no earlier than the largest base could end at the front, so the front
+     * always holds the next one. */
+    size_t start = headersSize;
+    if (logEnd_ != 0 && compactSize_ > baseStart_ - headersSize)
+    {
+        start = maxSize ? std::max(logEnd_, headersSize + maxBaseSize())
+                        : logEnd_;
+    }
+    if (maxSize && start + compactSize_ > *maxSize)
+    {
+        throw std::runtime_error("No room left to compact the log");
+    }
+
+    LogHeader header;
+    header.magic = logMagic;
+    header.epoch = epoch_ + 1;
+    header.baseStart = start;
+    header.baseEnd = start + compactSize_;
+    header.headerCrc = logHeaderCrc(header);
+
+    std::string base;
+    base.reserve(compactSize_);
+    uint32_t crc = header.headerCrc;
+    auto append = [&](uint8_t type, std::string_view id,
+                      std::span<const uint8_t> data) {
+        auto record = encodeRecord(header.epoch, crc, type, id, 0, data);
+        crc = *reinterpret_cast<const boost::endian::little_uint32_t*>(
+            record.data());
+        base += record;
+    };
+    append(RecordType::baseIdRecord, baseBlobId_, {});
+    for (const auto& [id, data] : blobs_)
+    {
+        append(RecordType::writeRecord, stdplus::strCat(baseBlobId_, id),
+               data);
+    }
+
+    /* The header goes last, over the one holding the older epoch */
+    file_->writeStr(base, start);
+    file_->writeStr(
+        std::string(reinterpret_cast<const char*>(&header), sizeof(header)),
+        (header.epoch % 2) * sizeof(header));
+    epoch_ = header.epoch;
+    baseStart_ = start;
+    baseEnd_ = logEnd_ = start + base.size();
+    logCrc_ = pendingCrc_ = crc;
+    ++commitStats_.commits;
+    commitStats_.bytesWritten += base.size() + sizeof(header);
+}
+
+const CommitStats& LogBinaryStore::getCommitStats() const
+{
+    return commitStats_;
+}
+
+bool LogBinaryStore::close(uint16_t session)
+{
+    if (!sessions_.erase(session))
+    {
+        log<level::ERR>("No open blob to close", entry("SESSION=%d", session));
+        return false;
+    }
+
+    /* Once the last session is gone, uncommitted records are discarded by
+     * replaying on the next open */
+    if (sessions_.empty() && !pendingLog_.empty())
+    {
+        commitState_ = CommitState::Dirty;
+    }
+    return true;
+}
+
+uint16_t LogBinaryStore::commitStateFlags() const
+{
+    uint16_t blobState = commitState_;
+    if (commitState_ == CommitState::Clean)
+    {
+        blobState |= blobs::StateFlags::committed;
+    }
+    else if (commitState_ == CommitState::CommitError)
+    {
+        blobState |= blobs::StateFlags::commit_error;
+    }
+    return blobState;
+}
+
+bool LogBinaryStore::stat(blobs::BlobMeta* meta)
+{
+    meta->size = 0;
+    meta->blobState = commitStateFlags();
+    return true;
+}
+
+bool LogBinaryStore::statBlob(const std::string& blobId,
+                              blobs::BlobMeta* meta)
+{
+    /* Report what opening the blob would find, without replaying the log
+     * unless it might not match what we have */
+    if (sessions_.empty() && commitState_ == CommitState::Dirty && !loadLog())
+    {
+        return false;
+    }
+
+    const auto id = relativeId(blobId);
+    const auto it = id ? blobs_.find(*id) : blobs_.end();
+    if (it == blobs_.end())
+    {
+        return stat(meta);
+    }
+
+    meta->size = it->second.size();
+    meta->blobState = commitStateFlags();
+    return true;
+}
+
+/*
+ * Sets |meta| with size and state of the blob open in |session|, like
+ * BinaryStore::stat().
+ */
+bool LogBinaryStore::stat(uint16_t session, blobs::BlobMeta* meta)
+{
+    auto it = sessions_.find(session);
+    if (it == sessions_.end())
+    {
+        return false;
+    }
+
+    uint16_t blobState = blobs::StateFlags::open_read;
+    if (it->second.writable)
+    {
+        blobState |= blobs::StateFlags::open_write;
+    }
+
+    meta->size = blobs_.find(*relativeId(it->second.blobId))->second.size();
+    meta->blobState = blobState | commitStateFlags();
+    return true;
+}
+
+} // namespace binstore
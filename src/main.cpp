@@ -68,12 +68,14 @@ std::unique_ptr<blobs::GenericBlobInterface> createHandler()
             entry("MAX_SIZE=%llx", static_cast<unsigned long long>(
                                        config.maxSizeBytes.value_or(0))));
 
-        auto file = std::make_unique<binstore::SysFileImpl>(config.sysFilePath,
-                                                            config.offsetBytes);
+        /* The sysfile is opened along with loading the store, which might be
+         * deferred */
+        auto openFile = [config] {
+            return std::make_unique<binstore::SysFileImpl>(config.sysFilePath,
+                                                           config.offsetBytes);
+        };
 
-        handler->addNewBinaryStore(binstore::BinaryStore::createFromConfig(
-            config.blobBaseId, std::move(file), config.maxSizeBytes,
-            config.aliasBlobBaseId));
+        handler->addNewBinaryStore(conf::createStore(config, openFile));
     }
 
     return handler;
@@ -0,0 +1,47 @@
+#include "sys_file_view.hpp"
+
+#include <algorithm>
+#include <system_error>
+
+namespace binstore
+{
+
+SysFileView::SysFileView(SysFile& file, size_t offset, size_t size) :
+    file_(file), offset_(offset), size_(size)
+{
+}
+
+size_t SysFileView::available(size_t pos, size_t count) const
+{
+    return pos < size_ ? std::min(count, size_ - pos) : 0;
+}
+
+size_t SysFileView::readToBuf(size_t pos, size_t count, char* buf) const
+{
+    count = available(pos, count);
+    return count ? file_.readToBuf(offset_ + pos, count, buf) : 0;
+}
+
+std::string SysFileView::readAsStr(size_t pos, size_t count) const
+{
+    count = available(pos, count);
+    return count ? file_.readAsStr(offset_ + pos, count) : std::string();
+}
+
+std::string SysFileView::readRemainingAsStr(size_t pos) const
+{
+    return readAsStr(pos, size_);
+}
+
+void SysFileView::writeStr(const std::string& data, size_t pos)
+{
+    if (available(pos, data.size()) != data.size())
+    {
+        throw std::system_error(
+            std::make_error_code(std::errc::no_space_on_device),
+            "Write past the end of the sysfile view");
+    }
+    file_.writeStr(data, offset_ + pos);
+}
+
+} // namespace binstore
@@ -1,15 +1,24 @@
 #include "binarystore.hpp"
 #include "binarystore_interface.hpp"
+#include "flat_image.hpp"
 #include "sys_file.hpp"
 
 #include <google/protobuf/text_format.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <future>
 #include <iostream>
 #include <ipmid/handler.hpp>
 #include <iterator>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdplus/print.hpp>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 #include "binaryblob.pb.h"
@@ -55,13 +64,17 @@ class SysFileBuf : public binstore::SysFile
     size_t readToBuf(size_t pos, size_t count, char* buf) const override
     {
         stdplus::print(stderr, "Read {} bytes at {}\n", count, pos);
-        return data_->copy(buf, count, pos);
+        ++readCount;
+        bytesRead += count;
+        return pos < data_->size() ? data_->copy(buf, count, pos) : 0;
     }
 
     std::string readAsStr(size_t pos, size_t count) const override
     {
         stdplus::print(stderr, "Read as str {} bytes at {}\n", count, pos);
-        return data_->substr(pos, count);
+        ++readCount;
+        bytesRead += count;
+        return pos < data_->size() ? data_->substr(pos, count) : "";
     }
 
     std::string readRemainingAsStr(size_t pos) const override
@@ -71,10 +84,18 @@ class SysFileBuf : public binstore::SysFile
 
     void writeStr(const std::string& data, size_t pos) override
     {
+        largestWrite = std::max(largestWrite, data.size());
+        if (pos > data_->size())
+        {
+            data_->resize(pos);
+        }
         data_->replace(pos, data.size(), data);
     }
 
     std::string* data_;
+    mutable size_t readCount = 0;
+    mutable size_t bytesRead = 0;
+    size_t largestWrite = 0;
 };
 
 using binstore::binaryblobproto::BinaryBlobBase;
@@ -83,6 +104,9 @@ using google::protobuf::TextFormat;
 using testing::ElementsAreArray;
 using testing::UnorderedElementsAre;
 
+constexpr uint16_t session = 0;
+constexpr uint16_t rwFlags = blobs::OpenFlags::write | blobs::OpenFlags::read;
+
 class BinaryStoreTest : public testing::Test
 {
   public:
@@ -166,6 +190,30 @@ TEST_F(BinaryStoreTest, TestSetBaseBlobId)
                                      "/blob/my-test-1/3"));
     // Check that the storage has changed
     EXPECT_NE(initialData, blobDataStorage);
+
+    // The renamed blobs are persisted under the new base id
+    BinaryBlobBase proto;
+    ASSERT_TRUE(proto.ParseFromString(blobDataStorage.substr(8)));
+    EXPECT_EQ("/blob/my-test-1/2", proto.blobs(2).blob_id());
+    store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test-1", std::make_unique<SysFileBuf>(&blobDataStorage),
+        std::nullopt);
+    ASSERT_TRUE(store);
+    const auto renamed = store->readBlob("/blob/my-test-1/2");
+    EXPECT_EQ(blobData, std::string(renamed.begin(), renamed.end()));
+}
+
+TEST_F(BinaryStoreTest, TestBlobOutsideBaseIdIsDropped)
+{
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/s/test", createBlobStorage("blob_base_id: \"/s/test\""
+                                     "blobs: [{ blob_id: \"/s/test/0\" }, "
+                                     "{ blob_id: \"/other/0\" }]"));
+    ASSERT_TRUE(store);
+    EXPECT_THAT(store->getBlobIds(),
+                UnorderedElementsAre("/s/test", "/s/test/0"));
+    EXPECT_FALSE(store->openOrCreateBlob(session, "/other/0", rwFlags));
+    EXPECT_THROW(store->readBlob("/other/0"), ipmi::HandlerCompletion);
 }
 
 TEST_F(BinaryStoreTest, TestReadBlob)
@@ -181,6 +229,32 @@ TEST_F(BinaryStoreTest, TestReadBlob)
     decltype(blobStoredData) origData(blobData.begin(), blobData.end());
 
     EXPECT_THAT(blobStoredData, ElementsAreArray(origData));
+    EXPECT_THAT(store->readBlobView("/blob/my-test/1"),
+                ElementsAreArray(origData));
+}
+
+TEST_F(BinaryStoreTest, TestReadIntoCallerBuffer)
+{
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", createBlobStorage(inputProto));
+    ASSERT_TRUE(store);
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+
+    const auto view = store->readView(session, 2, 5);
+    EXPECT_EQ(blobData.substr(2, 5), std::string(view.begin(), view.end()));
+
+    std::array<uint8_t, 8> buf;
+    EXPECT_EQ(buf.size(), store->readInto(session, 0, buf));
+    EXPECT_EQ(blobData.substr(0, buf.size()),
+              std::string(buf.begin(), buf.end()));
+    EXPECT_EQ(3u, store->readInto(session, blobData.size() - 3, buf));
+    EXPECT_EQ(0u, store->readInto(session, blobData.size(), buf));
+
+    const std::array<uint8_t, 2> data = {'x', 'y'};
+    EXPECT_TRUE(store->write(session, 1, std::span<const uint8_t>(data)));
+    const auto written = store->read(session, 0, 3);
+    EXPECT_EQ(blobData.substr(0, 1) + "xy",
+              std::string(written.begin(), written.end()));
 }
 
 TEST_F(BinaryStoreTest, TestReadBlobError)
@@ -191,6 +265,8 @@ TEST_F(BinaryStoreTest, TestReadBlobError)
     ASSERT_TRUE(store);
 
     EXPECT_THROW(store->readBlob("/nonexistent/1"), ipmi::HandlerCompletion);
+    EXPECT_THROW(store->readBlobView("/nonexistent/1"),
+                 ipmi::HandlerCompletion);
 }
 
 TEST_F(BinaryStoreTest, TestOpenReadOnlyBlob)
@@ -200,10 +276,11 @@ TEST_F(BinaryStoreTest, TestOpenReadOnlyBlob)
         binstore::BinaryStore::createFromFile(std::move(testDataFile), true);
     ASSERT_TRUE(store);
 
-    EXPECT_TRUE(
-        store->openOrCreateBlob("/blob/my-test/2", blobs::OpenFlags::read));
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/2",
+                                        blobs::OpenFlags::read));
     EXPECT_FALSE(store->openOrCreateBlob(
-        "/blob/my-test/2", blobs::OpenFlags::read & blobs::OpenFlags::write));
+        session + 1, "/blob/my-test/2",
+        blobs::OpenFlags::read & blobs::OpenFlags::write));
 }
 
 TEST_F(BinaryStoreTest, TestWriteExceedMaxSize)
@@ -214,17 +291,17 @@ TEST_F(BinaryStoreTest, TestWriteExceedMaxSize)
         "/s/test", std::move(testDataFile), 48);
     ASSERT_TRUE(store);
 
-    EXPECT_TRUE(store->openOrCreateBlob(
-        "/s/test/0", blobs::OpenFlags::write | blobs::OpenFlags::read));
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/s/test/0", rwFlags));
     // Current size 22(blob_) + 8(size var) = 30
     EXPECT_TRUE(store->write(
-        0, writeData)); // 42 =  30(existing) + 10 (data) + 2 (blob_id '/0')
-    EXPECT_FALSE(
-        store->write(10, writeData)); // 52 = 42 (existing) + 10 (new data)
-    EXPECT_FALSE(
-        store->write(7, writeData)); // 49 = 42 (existing) + 7 (new data)
-    EXPECT_TRUE(
-        store->write(6, writeData)); // 48 = 42 (existing) + 6 (new data)
+        session, 0,
+        writeData)); // 42 =  30(existing) + 10 (data) + 2 (blob_id '/0')
+    EXPECT_FALSE(store->write(
+        session, 10, writeData)); // 52 = 42 (existing) + 10 (new data)
+    EXPECT_FALSE(store->write(
+        session, 7, writeData)); // 49 = 42 (existing) + 7 (new data)
+    EXPECT_TRUE(store->write(
+        session, 6, writeData)); // 48 = 42 (existing) + 6 (new data)
 }
 
 TEST_F(BinaryStoreTest, TestCreateFromConfigExceedMaxSize)
@@ -233,5 +310,1080 @@ TEST_F(BinaryStoreTest, TestCreateFromConfigExceedMaxSize)
     auto store = binstore::BinaryStore::createFromConfig(
         "/blob/my-test", std::move(testDataFile), 1);
     ASSERT_TRUE(store);
-    EXPECT_FALSE(store->commit());
+    EXPECT_FALSE(store->commit(session));
+}
+
+TEST_F(BinaryStoreTest, TestWriteSizeTallyMatchesCommit)
+{
+    auto testDataFile = createBlobStorage(smallInputProto);
+    // 8 (size var) + 9 (base id) + 147 (blob with 130 bytes of data), where
+    // both the data and the blob entry lengths need a 2-byte varint.
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/s/test", std::move(testDataFile), 164);
+    ASSERT_TRUE(store);
+
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/s/test/0", rwFlags));
+    std::vector<uint8_t> chunk(10, 0x5a);
+    for (uint32_t offset = 0; offset < 130; offset += chunk.size())
+    {
+        EXPECT_TRUE(store->write(session, offset, chunk));
+    }
+    EXPECT_FALSE(store->write(session, 130, {0}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_EQ(164, blobDataStorage.size());
+}
+
+TEST_F(BinaryStoreTest, TestDeltaCommitOnlyWritesChangedBlocks)
+{
+    auto testDataFile = createBlobStorage(inputProto);
+    binstore::StoreOptions options;
+    options.deltaCommitGranularity = 16;
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::move(testDataFile), std::nullopt, std::nullopt,
+        options);
+    ASSERT_TRUE(store);
+    auto* binaryStore = dynamic_cast<binstore::BinaryStore*>(store.get());
+    ASSERT_NE(nullptr, binaryStore);
+
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/2", rwFlags));
+    EXPECT_TRUE(store->write(session, 3, {'x', 'y'}));
+    EXPECT_TRUE(store->commit(session));
+
+    // Nanopb re-encodes the image the same way, so only the block holding
+    // the modified bytes is rewritten.
+    EXPECT_EQ(1, binaryStore->getCommitStats().commits);
+    EXPECT_GE(16 * 2, binaryStore->getCommitStats().bytesWritten);
+    EXPECT_LT(0, binaryStore->getCommitStats().bytesWritten);
+
+    // The result must be identical to a full rewrite
+    auto committedData = blobDataStorage;
+    auto fullStore = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", createBlobStorage(inputProto));
+    ASSERT_TRUE(fullStore);
+    EXPECT_TRUE(
+        fullStore->openOrCreateBlob(session, "/blob/my-test/2", rwFlags));
+    EXPECT_TRUE(fullStore->write(session, 3, {'x', 'y'}));
+    EXPECT_TRUE(fullStore->commit(session));
+    EXPECT_EQ(blobDataStorage, committedData);
+}
+
+TEST_F(BinaryStoreTest, TestUnchangedCommitIsSkipped)
+{
+    auto testDataFile = createBlobStorage(inputProto);
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::move(testDataFile));
+    ASSERT_TRUE(store);
+    auto* binaryStore = dynamic_cast<binstore::BinaryStore*>(store.get());
+    ASSERT_NE(nullptr, binaryStore);
+
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    // Nothing changed since load
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_EQ(0, binaryStore->getCommitStats().commits);
+
+    // Rewriting the same bytes is not a change either
+    EXPECT_TRUE(store->write(session, 0,
+                             std::vector<uint8_t>(blobData.begin(),
+                                                  blobData.begin() + 4)));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_EQ(0, binaryStore->getCommitStats().commits);
+
+    EXPECT_TRUE(store->write(session, 0, {'a'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_EQ(1, binaryStore->getCommitStats().commits);
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_EQ(1, binaryStore->getCommitStats().commits);
+
+    blobs::BlobMeta meta;
+    EXPECT_TRUE(store->stat(&meta));
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::committed);
+}
+
+TEST_F(BinaryStoreTest, TestReopenWithoutChangesDoesNotReload)
+{
+    auto testDataFile = createBlobStorage(inputProto);
+    const auto* file = testDataFile.get();
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::move(testDataFile));
+    ASSERT_TRUE(store);
+    const auto loadReads = file->readCount;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        EXPECT_TRUE(
+            store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+        EXPECT_FALSE(store->read(session, 0, 4).empty());
+        EXPECT_TRUE(store->close(session));
+    }
+    EXPECT_EQ(loadReads, file->readCount);
+
+    // Uncommitted changes are still discarded on the next open
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'a'}));
+    EXPECT_TRUE(store->close(session));
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1",
+                                        blobs::OpenFlags::read));
+    EXPECT_LT(loadReads, file->readCount);
+    EXPECT_EQ(blobData[0], store->read(session, 0, 1).at(0));
+}
+
+TEST_F(BinaryStoreTest, TestLazyLoadReadsPayloadsOnDemand)
+{
+    const std::string bigData(4096, 'x');
+    BinaryBlobBase storeProto;
+    storeProto.set_blob_base_id("/blob/my-test");
+    for (int i = 0; i < 4; ++i)
+    {
+        auto* blob = storeProto.add_blobs();
+        blob->set_blob_id("/blob/my-test/" + std::to_string(i));
+        blob->set_data(bigData + std::to_string(i));
+    }
+    std::string textProto;
+    TextFormat::PrintToString(storeProto, &textProto);
+
+    auto testDataFile = createBlobStorage(textProto);
+    const auto* file = testDataFile.get();
+    binstore::StoreOptions options;
+    options.lazyLoad = true;
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::move(testDataFile), std::nullopt, std::nullopt,
+        options);
+    ASSERT_TRUE(store);
+    EXPECT_LT(file->bytesRead, bigData.size());
+    EXPECT_THAT(store->getBlobIds(),
+                UnorderedElementsAre("/blob/my-test", "/blob/my-test/0",
+                                     "/blob/my-test/1", "/blob/my-test/2",
+                                     "/blob/my-test/3"));
+
+    // Stat by id answers from the index
+    blobs::BlobMeta meta;
+    EXPECT_TRUE(store->statBlob("/blob/my-test/0", &meta));
+    EXPECT_EQ(bigData.size() + 1, meta.size);
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::committed);
+    EXPECT_LT(file->bytesRead, bigData.size());
+
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1",
+                                        blobs::OpenFlags::read));
+    EXPECT_TRUE(store->stat(session, &meta));
+    EXPECT_EQ(bigData.size() + 1, meta.size);
+    EXPECT_EQ("x1", [&] {
+        auto data = store->read(session, bigData.size() - 1, 2);
+        return std::string(data.begin(), data.end());
+    }());
+    EXPECT_TRUE(store->close(session));
+    EXPECT_LT(file->bytesRead, 2 * bigData.size());
+
+    const auto blob2 = store->readBlob("/blob/my-test/2");
+    EXPECT_EQ(bigData + "2", std::string(blob2.begin(), blob2.end()));
+    const auto blob3 = store->readBlobView("/blob/my-test/3");
+    EXPECT_EQ(bigData + "3", std::string(blob3.begin(), blob3.end()));
+
+    // Committing keeps the payloads that were never read
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/4", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'y'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+
+    storeProto.add_blobs()->set_blob_id("/blob/my-test/4");
+    storeProto.mutable_blobs(4)->set_data("y");
+    BinaryBlobBase committed;
+    committed.ParseFromString(blobDataStorage.substr(sizeof(uint64_t)));
+    EXPECT_EQ(storeProto.SerializeAsString(), committed.SerializeAsString());
+}
+
+TEST_F(BinaryStoreTest, TestLazyLoadReadsWrittenPayloadsFromMemory)
+{
+    auto testDataFile = createBlobStorage(inputProto);
+    binstore::StoreOptions options;
+    options.lazyLoad = true;
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::move(testDataFile), std::nullopt, std::nullopt,
+        options);
+    ASSERT_TRUE(store);
+    auto readBlob = [&](const std::string& blobId) {
+        auto data = store->readBlob(blobId);
+        return std::string(data.begin(), data.end());
+    };
+
+    // Written payloads are read back before they are committed
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'?'}));
+    EXPECT_EQ("?" + blobData.substr(1), readBlob("/blob/my-test/1"));
+    EXPECT_TRUE(store->openOrCreateBlob(1, "/blob/my-test/4", rwFlags));
+    EXPECT_EQ("", readBlob("/blob/my-test/4"));
+    EXPECT_TRUE(store->write(1, 0, {'n', 'e', 'w'}));
+    EXPECT_EQ("new", readBlob("/blob/my-test/4"));
+
+    // and after
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+    EXPECT_TRUE(store->close(1));
+    EXPECT_EQ("?" + blobData.substr(1), readBlob("/blob/my-test/1"));
+    EXPECT_EQ("new", readBlob("/blob/my-test/4"));
+    EXPECT_EQ(blobData, readBlob("/blob/my-test/2"));
+}
+
+TEST_F(BinaryStoreTest, TestWriteAfterLoadOnlyChangesWrittenBlob)
+{
+    auto testDataFile = createBlobStorage(inputProto);
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::move(testDataFile));
+    ASSERT_TRUE(store);
+
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(session, blobData.size(), {'!'}));
+    EXPECT_TRUE(store->write(session, 0, {'?'}));
+    auto expected = "?" + blobData.substr(1) + "!";
+    auto data = store->read(session, 0, expected.size());
+    EXPECT_EQ(expected, std::string(data.begin(), data.end()));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+
+    for (const auto& id : {"/blob/my-test/0", "/blob/my-test/2"})
+    {
+        data = store->readBlob(id);
+        EXPECT_EQ(blobData, std::string(data.begin(), data.end()));
+    }
+
+    BinaryBlobBase committed;
+    committed.ParseFromString(blobDataStorage.substr(sizeof(uint64_t)));
+    ASSERT_EQ(4, committed.blobs_size());
+    EXPECT_EQ(blobData, committed.blobs(0).data());
+    EXPECT_EQ(expected, committed.blobs(1).data());
+    EXPECT_EQ(blobData, committed.blobs(3).data());
+}
+
+TEST_F(BinaryStoreTest, TestCommitStreamsInBoundedChunks)
+{
+    auto testDataFile = createBlobStorage(smallInputProto);
+    auto* file = testDataFile.get();
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/s/test", std::move(testDataFile));
+    ASSERT_TRUE(store);
+
+    const std::vector<uint8_t> bigData(5000, 'z');
+    for (const auto& id : {"/s/test/0", "/s/test/1", "/s/test/2"})
+    {
+        EXPECT_TRUE(store->openOrCreateBlob(session, id, rwFlags));
+        EXPECT_TRUE(store->write(session, 0, bigData));
+        EXPECT_TRUE(store->commit(session));
+        EXPECT_TRUE(store->close(session));
+    }
+    EXPECT_LT(file->largestWrite, bigData.size());
+
+    uint64_t size;
+    std::memcpy(&size, blobDataStorage.data(), sizeof(size));
+    BinaryBlobBase committed;
+    ASSERT_TRUE(committed.ParseFromString(
+        blobDataStorage.substr(sizeof(size), size)));
+    EXPECT_EQ("/s/test", committed.blob_base_id());
+    ASSERT_EQ(3, committed.blobs_size());
+    for (const auto& blob : committed.blobs())
+    {
+        EXPECT_EQ(std::string(bigData.begin(), bigData.end()), blob.data());
+    }
+}
+
+TEST_F(BinaryStoreTest, TestSlotCommitFallsBackToPreviousImage)
+{
+    binstore::StoreOptions options;
+    options.slotSize = 256;
+    auto createStore = [&] {
+        return binstore::BinaryStore::createFromConfig(
+            "/s/test", std::make_unique<SysFileBuf>(&blobDataStorage),
+            std::nullopt, std::nullopt, options);
+    };
+    auto readFirstBlob = [](binstore::BinaryStoreInterface& store) {
+        auto data = store.readBlob("/s/test/0");
+        return std::string(data.begin(), data.end());
+    };
+
+    auto store = createStore();
+    ASSERT_TRUE(store);
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/s/test/0", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'o', 'l', 'd'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->write(session, 0, {'n', 'e', 'w'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+
+    store = createStore();
+    ASSERT_TRUE(store);
+    EXPECT_EQ("new", readFirstBlob(*store));
+
+    // Corrupt the newest image like an interrupted commit would
+    blobDataStorage[256 + 40] ^= 0xff;
+    store = createStore();
+    ASSERT_TRUE(store);
+    EXPECT_EQ("old", readFirstBlob(*store));
+
+    // The next commit replaces the corrupted slot
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/s/test/0", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'f', 'i', 'x'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+    EXPECT_EQ("fix", readFirstBlob(*createStore()));
+
+    // Neither slot can hold more than its size
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/s/test/0", rwFlags));
+    EXPECT_FALSE(store->write(session, 0, std::vector<uint8_t>(256, 'x')));
+}
+
+TEST_F(BinaryStoreTest, TestTornSlotPayloadFallsBackToPreviousImage)
+{
+    for (auto format :
+         {binstore::ImageFormat::Proto, binstore::ImageFormat::Flat})
+    {
+        for (bool lazyLoad : {false, true})
+        {
+            blobDataStorage.clear();
+            binstore::StoreOptions options;
+            options.slotSize = 512;
+            options.format = format;
+            options.lazyLoad = lazyLoad;
+            auto createStore = [&] {
+                return binstore::BinaryStore::createFromConfig(
+                    "/s/test", std::make_unique<SysFileBuf>(&blobDataStorage),
+                    std::nullopt, std::nullopt, options);
+            };
+
+            auto store = createStore();
+            ASSERT_TRUE(store);
+            EXPECT_TRUE(
+                store->openOrCreateBlob(session, "/s/test/0", rwFlags));
+            EXPECT_TRUE(store->write(session, 0, {'o', 'l', 'd', '!'}));
+            EXPECT_TRUE(store->commit(session));
+            EXPECT_TRUE(store->write(session, 0, {'n', 'e', 'w', '!'}));
+            EXPECT_TRUE(store->commit(session));
+            EXPECT_TRUE(store->close(session));
+
+            // A payload torn in the newest slot, whichever way it's loaded
+            const auto pos = blobDataStorage.find("new!");
+            ASSERT_NE(std::string::npos, pos);
+            blobDataStorage[pos] ^= 0xff;
+            store = createStore();
+            ASSERT_TRUE(store);
+            EXPECT_EQ(std::vector<uint8_t>({'o', 'l', 'd', '!'}),
+                      store->readBlob("/s/test/0"));
+        }
+    }
+}
+
+TEST_F(BinaryStoreTest, TestLazyLoadReadsPayloadsFromActiveSlot)
+{
+    binstore::StoreOptions options;
+    options.slotSize = 256;
+    options.lazyLoad = true;
+    auto createStore = [&] {
+        return binstore::BinaryStore::createFromConfig(
+            "/s/test", std::make_unique<SysFileBuf>(&blobDataStorage),
+            std::nullopt, std::nullopt, options);
+    };
+
+    auto store = createStore();
+    ASSERT_TRUE(store);
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/s/test/0", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'f', 'i', 'r', 's', 't'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+
+    // Payloads are read from the first slot, past its header
+    store = createStore();
+    ASSERT_TRUE(store);
+    auto data = store->readBlob("/s/test/0");
+    EXPECT_EQ("first", std::string(data.begin(), data.end()));
+
+    // and from the second slot once it holds the newest image
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/s/test/1", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'s', 'e', 'c'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+    store = createStore();
+    ASSERT_TRUE(store);
+    data = store->readBlob("/s/test/0");
+    EXPECT_EQ("first", std::string(data.begin(), data.end()));
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/s/test/1",
+                                        blobs::OpenFlags::read));
+    EXPECT_EQ(store->read(session, 0, 3),
+              std::vector<uint8_t>({'s', 'e', 'c'}));
+}
+
+TEST_F(BinaryStoreTest, TestDeleteBlob)
+{
+    auto testDataFile = createBlobStorage(inputProto);
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::move(testDataFile));
+    ASSERT_TRUE(store);
+
+    // The open blob and unknown blobs can't be deleted
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1",
+                                        blobs::OpenFlags::read));
+    EXPECT_FALSE(store->deleteBlob("/blob/my-test/1"));
+    EXPECT_TRUE(store->close(session));
+    EXPECT_FALSE(store->deleteBlob("/blob/my-test/9"));
+
+    const auto sizeBefore = blobDataStorage.size();
+    EXPECT_TRUE(store->deleteBlob("/blob/my-test/1"));
+    EXPECT_FALSE(store->deleteBlob("/blob/my-test/1"));
+    EXPECT_THAT(store->getBlobIds(),
+                UnorderedElementsAre("/blob/my-test", "/blob/my-test/0",
+                                     "/blob/my-test/2", "/blob/my-test/3"));
+
+    // The deletion is persisted and shrinks the image
+    BinaryBlobBase committed;
+    const uint64_t committedSize =
+        *reinterpret_cast<const uint64_t*>(blobDataStorage.data());
+    EXPECT_LT(committedSize, sizeBefore - sizeof(uint64_t) - blobData.size());
+    committed.ParseFromString(
+        blobDataStorage.substr(sizeof(uint64_t), committedSize));
+    EXPECT_EQ(3, committed.blobs_size());
+
+    store = binstore::BinaryStore::createFromFile(
+        std::make_unique<SysFileBuf>(&blobDataStorage), true);
+    EXPECT_THAT(store->getBlobIds(),
+                UnorderedElementsAre("/blob/my-test", "/blob/my-test/0",
+                                     "/blob/my-test/2", "/blob/my-test/3"));
+    EXPECT_FALSE(store->deleteBlob("/blob/my-test/0"));
+}
+
+TEST_F(BinaryStoreTest, TestConcurrentSessions)
+{
+    auto testDataFile = createBlobStorage(inputProto);
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::move(testDataFile));
+    ASSERT_TRUE(store);
+
+    const uint16_t reader = 1, otherReader = 2, writer = 3;
+    EXPECT_TRUE(store->openOrCreateBlob(reader, "/blob/my-test/1",
+                                        blobs::OpenFlags::read));
+    EXPECT_TRUE(store->openOrCreateBlob(otherReader, "/blob/my-test/2",
+                                        blobs::OpenFlags::read));
+    EXPECT_TRUE(store->openOrCreateBlob(writer, "/blob/my-test/1", rwFlags));
+    // A session has a single blob open, and a blob a single writer
+    EXPECT_FALSE(store->openOrCreateBlob(reader, "/blob/my-test/3",
+                                         blobs::OpenFlags::read));
+    EXPECT_FALSE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    EXPECT_FALSE(store->write(reader, 0, {'a'}));
+
+    // Sessions share the in-memory data of the store
+    EXPECT_TRUE(store->write(writer, 0, {'a'}));
+    EXPECT_THAT(store->read(reader, 0, 1), ElementsAreArray({'a'}));
+    EXPECT_THAT(store->read(otherReader, 0, 1),
+                ElementsAreArray({blobData[0]}));
+
+    blobs::BlobMeta meta;
+    EXPECT_TRUE(store->stat(reader, &meta));
+    EXPECT_FALSE(meta.blobState & blobs::StateFlags::open_write);
+    EXPECT_TRUE(meta.blobState & binstore::BinaryStore::CommitState::Dirty);
+    EXPECT_TRUE(store->stat(writer, &meta));
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::open_write);
+
+    // Closing one session keeps the changes of the others
+    EXPECT_TRUE(store->close(writer));
+    EXPECT_FALSE(store->close(writer));
+    EXPECT_THAT(store->read(reader, 0, 1), ElementsAreArray({'a'}));
+    EXPECT_TRUE(store->openOrCreateBlob(writer, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(writer, 1, {'b'}));
+    EXPECT_TRUE(store->close(writer));
+
+    // A commit from any session persists the whole store
+    EXPECT_TRUE(store->commit(otherReader));
+    EXPECT_FALSE(store->commit(writer));
+    EXPECT_TRUE(store->close(reader));
+    EXPECT_TRUE(store->close(otherReader));
+
+    const auto data = binstore::BinaryStore::createFromFile(
+                          std::make_unique<SysFileBuf>(&blobDataStorage), true)
+                          ->readBlob("/blob/my-test/1");
+    EXPECT_EQ("ab", std::string(data.begin(), data.begin() + 2));
+}
+
+TEST_F(BinaryStoreTest, TestSessionFollowsBlobWhenOthersMove)
+{
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", createBlobStorage(inputProto));
+    ASSERT_TRUE(store);
+
+    const uint16_t other = session + 1;
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/2", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'a'}));
+
+    // Blobs added or removed before it shift the open blob
+    EXPECT_TRUE(store->openOrCreateBlob(other, "/blob/my-test/10", rwFlags));
+    EXPECT_TRUE(store->write(other, 0, {'b'}));
+    EXPECT_THAT(store->read(session, 0, 1), ElementsAreArray({'a'}));
+    EXPECT_TRUE(store->write(session, 1, {'c'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(other));
+    EXPECT_TRUE(store->deleteBlob("/blob/my-test/0"));
+    EXPECT_THAT(store->read(session, 0, 2), ElementsAreArray({'a', 'c'}));
+    blobs::BlobMeta meta;
+    EXPECT_TRUE(store->stat(session, &meta));
+    EXPECT_EQ(blobData.size(), meta.size);
+    EXPECT_TRUE(store->close(session));
+
+    EXPECT_THAT(store->readBlob("/blob/my-test/10"), ElementsAreArray({'b'}));
+}
+
+TEST_F(BinaryStoreTest, TestUncommittedChangesDiscardedAfterLastClose)
+{
+    auto testDataFile = createBlobStorage(inputProto);
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::move(testDataFile));
+    ASSERT_TRUE(store);
+
+    const uint16_t reader = 1, writer = 2;
+    EXPECT_TRUE(store->openOrCreateBlob(reader, "/blob/my-test/1",
+                                        blobs::OpenFlags::read));
+    EXPECT_TRUE(store->openOrCreateBlob(writer, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(writer, 0, {'a'}));
+    EXPECT_TRUE(store->close(writer));
+    // Deleting would commit the pending write
+    EXPECT_FALSE(store->deleteBlob("/blob/my-test/2"));
+    EXPECT_TRUE(store->close(reader));
+
+    EXPECT_TRUE(store->openOrCreateBlob(reader, "/blob/my-test/1",
+                                        blobs::OpenFlags::read));
+    EXPECT_THAT(store->read(reader, 0, 1), ElementsAreArray({blobData[0]}));
+}
+
+/* Sysfile whose writes wait until the test releases them */
+class GatedSysFileBuf : public SysFileBuf
+{
+  public:
+    GatedSysFileBuf(std::string* storage, std::shared_future<void> gate) :
+        SysFileBuf(storage), gate_(std::move(gate))
+    {
+    }
+
+    void writeStr(const std::string& data, size_t pos) override
+    {
+        gate_.wait();
+        SysFileBuf::writeStr(data, pos);
+    }
+
+  private:
+    std::shared_future<void> gate_;
+};
+
+TEST_F(BinaryStoreTest, TestAsyncCommitReportsCommitting)
+{
+    createBlobStorage(inputProto);
+    std::promise<void> release;
+    binstore::StoreOptions options;
+    options.asyncCommit = true;
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test",
+        std::make_unique<GatedSysFileBuf>(&blobDataStorage,
+                                          release.get_future().share()),
+        std::nullopt, std::nullopt, options);
+    ASSERT_TRUE(store);
+    const auto initialData = blobDataStorage;
+
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'a'}));
+    EXPECT_TRUE(store->commit(session));
+
+    // The commit is in flight until the sysfile accepts the write
+    blobs::BlobMeta meta;
+    EXPECT_TRUE(store->stat(session, &meta));
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::committing);
+    EXPECT_FALSE(meta.blobState & blobs::StateFlags::committed);
+    EXPECT_EQ(initialData, blobDataStorage);
+
+    // Writes made meanwhile aren't part of the snapshot
+    EXPECT_TRUE(store->write(session, 1, {'b'}));
+    release.set_value();
+    for (int i = 0;
+         i < 1000 && (meta.blobState & blobs::StateFlags::committing); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        EXPECT_TRUE(store->stat(session, &meta));
+    }
+    EXPECT_FALSE(meta.blobState & blobs::StateFlags::committing);
+    EXPECT_FALSE(meta.blobState & blobs::StateFlags::committed);
+    EXPECT_TRUE(meta.blobState & binstore::BinaryStore::CommitState::Dirty);
+    auto committed = binstore::BinaryStore::createFromFile(
+                         std::make_unique<SysFileBuf>(&blobDataStorage), true)
+                         ->readBlob("/blob/my-test/1");
+    EXPECT_EQ("a" + blobData.substr(1),
+              std::string(committed.begin(), committed.end()));
+
+    // Destroying the store waits for the last commit
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+    store.reset();
+    committed = binstore::BinaryStore::createFromFile(
+                    std::make_unique<SysFileBuf>(&blobDataStorage), true)
+                    ->readBlob("/blob/my-test/1");
+    EXPECT_EQ("ab" + blobData.substr(2),
+              std::string(committed.begin(), committed.end()));
+}
+
+TEST_F(BinaryStoreTest, TestStatBlobDoesNotWaitForAsyncCommit)
+{
+    createBlobStorage(inputProto);
+    std::promise<void> release;
+    binstore::StoreOptions options;
+    options.asyncCommit = true;
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test",
+        std::make_unique<GatedSysFileBuf>(&blobDataStorage,
+                                          release.get_future().share()),
+        std::nullopt, std::nullopt, options);
+    ASSERT_TRUE(store);
+
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'a'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+
+    // The blob is reported from memory while its commit is in flight
+    blobs::BlobMeta meta;
+    auto statting = std::async(std::launch::async, [&store, &meta] {
+        return store->statBlob("/blob/my-test/1", &meta);
+    });
+    const bool waited = statting.wait_for(std::chrono::seconds(10)) !=
+                        std::future_status::ready;
+    release.set_value();
+    EXPECT_FALSE(waited);
+    EXPECT_TRUE(statting.get());
+    EXPECT_EQ(blobData.size(), meta.size);
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::committing);
+}
+
+TEST_F(BinaryStoreTest, TestWriteBackCoalescesCommits)
+{
+    binstore::StoreOptions options;
+    options.writeBackDirtyBytes = 3;
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", createBlobStorage(inputProto), std::nullopt,
+        std::nullopt, options);
+    ASSERT_TRUE(store);
+    const auto initialData = blobDataStorage;
+
+    // Commits are acknowledged but held back below the threshold
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'a'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->write(session, 1, {'b'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_EQ(initialData, blobDataStorage);
+    blobs::BlobMeta meta;
+    EXPECT_TRUE(store->stat(session, &meta));
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::committing);
+
+    // Reaching it writes the latest snapshot once
+    EXPECT_TRUE(store->write(session, 2, {'c'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_NE(initialData, blobDataStorage);
+    auto& stats = dynamic_cast<binstore::BinaryStore&>(*store).getCommitStats();
+    EXPECT_EQ(stats.commits, 1);
+    EXPECT_TRUE(store->stat(session, &meta));
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::committed);
+
+    // Closing the session writes what is held back
+    EXPECT_TRUE(store->write(session, 3, {'d'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_EQ(stats.commits, 1);
+    EXPECT_TRUE(store->close(session));
+    EXPECT_EQ(stats.commits, 2);
+    auto committed = binstore::BinaryStore::createFromFile(
+                         std::make_unique<SysFileBuf>(&blobDataStorage), true)
+                         ->readBlob("/blob/my-test/1");
+    EXPECT_EQ("abcd" + blobData.substr(4),
+              std::string(committed.begin(), committed.end()));
+}
+
+/* Sysfile whose writes always fail */
+class FailingSysFileBuf : public SysFileBuf
+{
+  public:
+    using SysFileBuf::SysFileBuf;
+
+    void writeStr(const std::string&, size_t) override
+    {
+        throw std::system_error(EIO, std::generic_category(), "write failed");
+    }
+};
+
+TEST_F(BinaryStoreTest, TestWriteBackFailureReportedOnClose)
+{
+    createBlobStorage(inputProto);
+    binstore::StoreOptions options;
+    options.writeBackDirtyBytes = 100;
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::make_unique<FailingSysFileBuf>(&blobDataStorage),
+        std::nullopt, std::nullopt, options);
+    ASSERT_TRUE(store);
+
+    // A held-back commit doesn't make the store clean, even if repeated
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'a'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->commit(session));
+    blobs::BlobMeta meta;
+    EXPECT_TRUE(store->stat(session, &meta));
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::committing);
+    EXPECT_TRUE(meta.blobState & binstore::BinaryStore::CommitState::Dirty);
+
+    // Writing it on close fails, and the error stays reported
+    EXPECT_FALSE(store->close(session));
+    EXPECT_TRUE(store->stat(&meta));
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::commit_error);
+    EXPECT_TRUE(meta.blobState &
+                binstore::BinaryStore::CommitState::CommitError);
+}
+
+/* Sysfile reporting its first write */
+class WatchedSysFileBuf : public SysFileBuf
+{
+  public:
+    using SysFileBuf::SysFileBuf;
+
+    void writeStr(const std::string& data, size_t pos) override
+    {
+        SysFileBuf::writeStr(data, pos);
+        std::call_once(once_, [this] { written.set_value(); });
+    }
+
+    std::promise<void> written;
+
+  private:
+    std::once_flag once_;
+};
+
+TEST_F(BinaryStoreTest, TestWriteBackFlushesAfterDelay)
+{
+    createBlobStorage(inputProto);
+    const auto initialData = blobDataStorage;
+    constexpr auto delay = std::chrono::milliseconds(200);
+    binstore::StoreOptions options;
+    options.writeBackDelay = delay;
+    auto testDataFile = std::make_unique<WatchedSysFileBuf>(&blobDataStorage);
+    auto written = testDataFile->written.get_future();
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::move(testDataFile), std::nullopt, std::nullopt,
+        options);
+    ASSERT_TRUE(store);
+
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'a'}));
+    const auto committed = std::chrono::steady_clock::now();
+    EXPECT_TRUE(store->commit(session));
+
+    // The commit is written once the quiet period is over, even if the store
+    // isn't used in the meantime
+    ASSERT_EQ(std::future_status::ready,
+              written.wait_for(std::chrono::seconds(10)));
+    EXPECT_LE(delay, std::chrono::steady_clock::now() - committed);
+    blobs::BlobMeta meta;
+    meta.blobState = blobs::StateFlags::committing;
+    for (int i = 0;
+         i < 1000 && (meta.blobState & blobs::StateFlags::committing); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        EXPECT_TRUE(store->stat(session, &meta));
+    }
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::committed);
+    EXPECT_NE(initialData, blobDataStorage);
+    EXPECT_EQ(1, dynamic_cast<binstore::BinaryStore&>(*store)
+                     .getCommitStats()
+                     .commits);
+
+    // A commit replacing a held back one drops it
+    EXPECT_TRUE(store->write(session, 0, {'b'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->write(session, 0, {'c'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+    EXPECT_EQ(2, dynamic_cast<binstore::BinaryStore&>(*store)
+                     .getCommitStats()
+                     .commits);
+    auto data = binstore::BinaryStore::createFromFile(
+                    std::make_unique<SysFileBuf>(&blobDataStorage), true)
+                    ->readBlob("/blob/my-test/1");
+    EXPECT_EQ("c" + blobData.substr(1), std::string(data.begin(), data.end()));
+}
+
+TEST_F(BinaryStoreTest, TestChecksumErrorReportedPerBlob)
+{
+    for (bool lazyLoad : {false, true})
+    {
+        binstore::StoreOptions options;
+        options.lazyLoad = lazyLoad;
+        options.checksums = true;
+        auto store = binstore::BinaryStore::createFromConfig(
+            "/blob/my-test", createBlobStorage(inputProto), std::nullopt,
+            std::nullopt, options);
+        ASSERT_TRUE(store);
+        EXPECT_TRUE(
+            store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+        EXPECT_TRUE(store->write(session, 0, {'a'}));
+        EXPECT_TRUE(store->commit(session));
+        EXPECT_TRUE(store->close(session));
+        store.reset();
+
+        // Flip a bit in the payload of the second blob
+        const auto pos = blobDataStorage.find("a" + blobData.substr(1));
+        ASSERT_NE(std::string::npos, pos);
+        blobDataStorage[pos + 1] ^= 0x01;
+
+        store = binstore::BinaryStore::createFromConfig(
+            "/blob/my-test", std::make_unique<SysFileBuf>(&blobDataStorage),
+            std::nullopt, std::nullopt, options);
+        ASSERT_TRUE(store);
+        blobs::BlobMeta meta;
+        EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/0",
+                                            blobs::OpenFlags::read));
+        EXPECT_TRUE(store->stat(session, &meta));
+        EXPECT_FALSE(meta.blobState &
+                     binstore::BinaryStore::CommitState::ChecksumError);
+        EXPECT_TRUE(store->close(session));
+
+        EXPECT_TRUE(
+            store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+        EXPECT_TRUE(store->stat(session, &meta));
+        EXPECT_TRUE(meta.blobState &
+                    binstore::BinaryStore::CommitState::ChecksumError);
+        EXPECT_TRUE(store->stat(&meta));
+        EXPECT_TRUE(meta.blobState &
+                    binstore::BinaryStore::CommitState::ChecksumError);
+
+        // Rewriting the blob replaces the corrupted payload
+        EXPECT_TRUE(store->write(session, 1, {'Y'}));
+        EXPECT_TRUE(store->stat(session, &meta));
+        EXPECT_FALSE(meta.blobState &
+                     binstore::BinaryStore::CommitState::ChecksumError);
+        EXPECT_TRUE(store->close(session));
+    }
+}
+
+#ifdef ENABLE_LZ4
+TEST_F(BinaryStoreTest, TestCompressedCommitFitsMaxSize)
+{
+    binstore::StoreOptions options;
+    options.compression = binstore::Compression::Lz4;
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", createBlobStorage(inputProto), 512, std::nullopt,
+        options);
+    ASSERT_TRUE(store);
+
+    // Far more than the max size, but it compresses well
+    const std::vector<uint8_t> text(4096, 'x');
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/4", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, text));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+    EXPECT_GE(512, blobDataStorage.size());
+
+    // Compressed images load whatever the options
+    for (bool lazyLoad : {false, true})
+    {
+        binstore::StoreOptions loadOptions;
+        loadOptions.lazyLoad = lazyLoad;
+        auto reloaded = binstore::BinaryStore::createFromConfig(
+            "/blob/my-test", std::make_unique<SysFileBuf>(&blobDataStorage),
+            std::nullopt, std::nullopt, loadOptions);
+        ASSERT_TRUE(reloaded);
+        EXPECT_EQ(text, reloaded->readBlob("/blob/my-test/4"));
+        const auto blob0 = reloaded->readBlob("/blob/my-test/0");
+        EXPECT_EQ(blobData, std::string(blob0.begin(), blob0.end()));
+    }
+
+    // The max size applies to the compressed image
+    std::vector<uint8_t> noise(1024);
+    uint32_t seed = 1;
+    for (auto& byte : noise)
+    {
+        seed = seed * 1103515245 + 12345;
+        byte = seed >> 24;
+    }
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/5", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, noise));
+    EXPECT_FALSE(store->commit(session));
+    EXPECT_TRUE(store->close(session));
+}
+#else
+TEST_F(BinaryStoreTest, TestCompressionNeedsLz4Support)
+{
+    binstore::StoreOptions options;
+    options.compression = binstore::Compression::Lz4;
+    EXPECT_FALSE(binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", createBlobStorage(inputProto), std::nullopt,
+        std::nullopt, options));
+}
+#endif
+
+TEST_F(BinaryStoreTest, TestUpgradeToFlatImage)
+{
+    // A loaded image keeps its format whatever the options say
+    binstore::StoreOptions options;
+    options.format = binstore::ImageFormat::Flat;
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", createBlobStorage(inputProto), std::nullopt,
+        std::nullopt, options);
+    ASSERT_TRUE(store);
+    auto* binaryStore = dynamic_cast<binstore::BinaryStore*>(store.get());
+    ASSERT_NE(nullptr, binaryStore);
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/4", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {'x', 'y'}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_EQ(binstore::ImageFormat::Proto, binaryStore->getImageFormat());
+    EXPECT_FALSE(binstore::flat::isFlatImage(blobDataStorage));
+
+    // Not while a session is open
+    EXPECT_FALSE(binaryStore->setImageFormat(binstore::ImageFormat::Flat));
+    EXPECT_TRUE(store->close(session));
+    EXPECT_TRUE(binaryStore->setImageFormat(binstore::ImageFormat::Flat));
+    EXPECT_TRUE(binstore::flat::isFlatImage(blobDataStorage));
+
+    for (bool lazyLoad : {false, true})
+    {
+        binstore::StoreOptions loadOptions;
+        loadOptions.lazyLoad = lazyLoad;
+        auto reloaded = binstore::BinaryStore::createFromFile(
+            std::make_unique<SysFileBuf>(&blobDataStorage), true, std::nullopt,
+            loadOptions);
+        ASSERT_TRUE(reloaded);
+        EXPECT_EQ("/blob/my-test", reloaded->getBaseBlobId());
+        EXPECT_THAT(reloaded->getBlobIds(),
+                    UnorderedElementsAre("/blob/my-test", "/blob/my-test/0",
+                                         "/blob/my-test/1", "/blob/my-test/2",
+                                         "/blob/my-test/3", "/blob/my-test/4"));
+        const auto blob1 = reloaded->readBlob("/blob/my-test/1");
+        EXPECT_EQ(blobData, std::string(blob1.begin(), blob1.end()));
+        EXPECT_EQ(std::vector<uint8_t>({'x', 'y'}),
+                  reloaded->readBlob("/blob/my-test/4"));
+    }
+
+    // And back, the flat image was larger
+    EXPECT_TRUE(binaryStore->setImageFormat(binstore::ImageFormat::Proto));
+    uint64_t size;
+    std::memcpy(&size, blobDataStorage.data(), sizeof(size));
+    BinaryBlobBase committed;
+    EXPECT_TRUE(committed.ParseFromString(
+        blobDataStorage.substr(sizeof(uint64_t), size)));
+    EXPECT_EQ(5, committed.blobs_size());
+}
+
+TEST_F(BinaryStoreTest, TestFlatCommitRewritesBlobInPlace)
+{
+    blobDataStorage.clear();
+    binstore::StoreOptions options;
+    options.format = binstore::ImageFormat::Flat;
+    auto store = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::make_unique<SysFileBuf>(&blobDataStorage),
+        std::nullopt, std::nullopt, options);
+    ASSERT_TRUE(store);
+    auto* binaryStore = dynamic_cast<binstore::BinaryStore*>(store.get());
+    ASSERT_NE(nullptr, binaryStore);
+
+    // Uncommitted blobs are dropped once no session is left
+    const std::vector<uint8_t> bigData(1024, 'x');
+    constexpr uint16_t otherSession = session + 1;
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, bigData));
+    for (int i : {0, 2, 3})
+    {
+        EXPECT_TRUE(store->openOrCreateBlob(
+            otherSession, "/blob/my-test/" + std::to_string(i), rwFlags));
+        EXPECT_TRUE(store->write(otherSession, 0, bigData));
+        EXPECT_TRUE(store->close(otherSession));
+    }
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_TRUE(binstore::flat::isFlatImage(blobDataStorage));
+
+    // Only the header, the table entry and the changed payload block
+    const auto before = binaryStore->getCommitStats();
+    EXPECT_TRUE(store->write(session, 500, {'y'}));
+    EXPECT_TRUE(store->commit(session));
+    const auto& after = binaryStore->getCommitStats();
+    EXPECT_EQ(before.commits + 1, after.commits);
+    EXPECT_GE(3 * binstore::flat::alignment,
+              after.bytesWritten - before.bytesWritten);
+    EXPECT_TRUE(store->close(session));
+
+    auto reloaded = binstore::BinaryStore::createFromFile(
+        std::make_unique<SysFileBuf>(&blobDataStorage));
+    ASSERT_TRUE(reloaded);
+    auto expected = bigData;
+    expected[500] = 'y';
+    EXPECT_EQ(expected, reloaded->readBlob("/blob/my-test/1"));
+    EXPECT_EQ(bigData, reloaded->readBlob("/blob/my-test/3"));
+
+    // Loading lazily only reads the index, which is enough to do the same
+    binstore::StoreOptions lazyOptions;
+    lazyOptions.lazyLoad = true;
+    auto lazy = binstore::BinaryStore::createFromConfig(
+        "/blob/my-test", std::make_unique<SysFileBuf>(&blobDataStorage),
+        std::nullopt, std::nullopt, lazyOptions);
+    ASSERT_TRUE(lazy);
+    EXPECT_TRUE(lazy->openOrCreateBlob(session, "/blob/my-test/3", rwFlags));
+    EXPECT_TRUE(lazy->write(session, 0, {'z'}));
+    EXPECT_TRUE(lazy->commit(session));
+    const auto& lazyStats =
+        dynamic_cast<binstore::BinaryStore&>(*lazy).getCommitStats();
+    EXPECT_EQ(1, lazyStats.commits);
+    EXPECT_GE(3 * binstore::flat::alignment, lazyStats.bytesWritten);
+}
+
+TEST_F(BinaryStoreTest, TestFlatImageInEveryCommitMode)
+{
+    std::vector<binstore::StoreOptions> modes(4);
+    modes[1].slotSize = 4096;
+    modes[2].asyncCommit = true;
+    modes[3].writeBackDirtyBytes = 1 << 20;
+    modes[3].writeBackDelay = std::chrono::hours(1);
+    for (auto options : modes)
+    {
+        blobDataStorage.clear();
+        options.format = binstore::ImageFormat::Flat;
+        auto store = binstore::BinaryStore::createFromConfig(
+            "/blob/my-test", std::make_unique<SysFileBuf>(&blobDataStorage),
+            std::nullopt, std::nullopt, options);
+        ASSERT_TRUE(store);
+
+        constexpr uint16_t otherSession = session + 1;
+        EXPECT_TRUE(
+            store->openOrCreateBlob(session, "/blob/my-test/1", rwFlags));
+        EXPECT_TRUE(store->write(session, 0, std::vector<uint8_t>(100, 'a')));
+        EXPECT_TRUE(store->commit(session));
+        EXPECT_TRUE(
+            store->openOrCreateBlob(otherSession, "/blob/my-test/0", rwFlags));
+        EXPECT_TRUE(store->write(otherSession, 0, {'b'}));
+        EXPECT_TRUE(store->commit(otherSession));
+        EXPECT_TRUE(store->close(otherSession));
+        EXPECT_TRUE(store->write(session, 10, {'c'}));
+        EXPECT_TRUE(store->commit(session));
+        EXPECT_TRUE(store->close(session));
+        store.reset();
+
+        auto expected = std::vector<uint8_t>(100, 'a');
+        expected[10] = 'c';
+        for (bool lazyLoad : {false, true})
+        {
+            binstore::StoreOptions loadOptions;
+            loadOptions.slotSize = options.slotSize;
+            loadOptions.lazyLoad = lazyLoad;
+            auto reloaded = binstore::BinaryStore::createFromFile(
+                std::make_unique<SysFileBuf>(&blobDataStorage), true,
+                std::nullopt, loadOptions);
+            ASSERT_TRUE(reloaded);
+            EXPECT_EQ(expected, reloaded->readBlob("/blob/my-test/1"));
+            EXPECT_EQ(std::vector<uint8_t>{'b'},
+                      reloaded->readBlob("/blob/my-test/0"));
+        }
+    }
+}
+
+TEST_F(BinaryStoreTest, TestUpgradeNeedsAnImage)
+{
+    blobDataStorage = "not a store";
+    auto store = binstore::BinaryStore::createFromFile(
+        std::make_unique<SysFileBuf>(&blobDataStorage), false);
+    auto* binaryStore = dynamic_cast<binstore::BinaryStore*>(store.get());
+    ASSERT_NE(nullptr, binaryStore);
+    EXPECT_FALSE(binaryStore->setImageFormat(binstore::ImageFormat::Flat));
+    EXPECT_EQ("not a store", blobDataStorage);
 }
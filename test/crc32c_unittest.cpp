@@ -0,0 +1,57 @@
+#include "crc32c.hpp"
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using binstore::crc32c;
+using binstore::crc32cPortable;
+
+TEST(Crc32cTest, KnownValues)
+{
+    EXPECT_EQ(0u, crc32c(""));
+    EXPECT_EQ(0xe3069283u, crc32c("123456789"));
+    EXPECT_EQ(0x8a9136aau, crc32c(std::vector<uint8_t>(32, 0)));
+    EXPECT_EQ(0x62a8ab43u, crc32c(std::vector<uint8_t>(32, 0xff)));
+}
+
+TEST(Crc32cTest, ChecksumInPieces)
+{
+    std::string data;
+    for (int i = 0; i < 1000; ++i)
+    {
+        data.push_back(static_cast<char>(i * 7));
+    }
+
+    const std::string_view view = data;
+    const auto whole = crc32c(view);
+    for (size_t split : {0, 1, 13, 500})
+    {
+        EXPECT_EQ(whole,
+                  crc32c(view.substr(split), crc32c(view.substr(0, split))))
+            << "split at " << split;
+    }
+}
+
+TEST(Crc32cTest, PortableMatchesDefault)
+{
+    std::vector<uint8_t> data(300);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<uint8_t>(i * 31 + 7);
+    }
+
+    // Cover every alignment and the tail of each word size
+    const std::span<const uint8_t> bytes = data;
+    for (size_t start = 0; start < 8; ++start)
+    {
+        for (size_t len : {0, 1, 3, 4, 7, 8, 9, 15, 16, 17, 255})
+        {
+            auto piece = bytes.subspan(start, len);
+            EXPECT_EQ(crc32c(piece, 0x1234), crc32cPortable(piece, 0x1234))
+                << "start " << start << " length " << len;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#include "binarystore.hpp"
+#include "deferred_binarystore.hpp"
+#include "fake_sys_file.hpp"
+#include "handler.hpp"
+
+#include <chrono>
+#include <future>
+#include <ipmid/handler.hpp>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+
+using namespace binstore;
+using testing::ElementsAre;
+
+constexpr uint16_t session = 0;
+constexpr uint16_t rwFlags = blobs::OpenFlags::write | blobs::OpenFlags::read;
+
+TEST(DeferredBinaryStoreTest, StatReportsLoadingUntilLoaded)
+{
+    std::promise<void> release;
+    auto released = release.get_future();
+    auto store = DeferredBinaryStore::createInBackground("/s/", [&released] {
+        released.wait();
+        return BinaryStore::createFromConfig("/s/",
+                                             std::make_unique<FakeSysFile>());
+    });
+    ASSERT_TRUE(store);
+    EXPECT_EQ("/s/", store->getBaseBlobId());
+
+    blobs::BlobMeta meta;
+    EXPECT_TRUE(store->stat(&meta));
+    EXPECT_EQ(0, meta.size);
+    EXPECT_EQ(BinaryStore::CommitState::Loading, meta.blobState);
+    EXPECT_TRUE(store->statBlob("/s/blob", &meta));
+    EXPECT_EQ(BinaryStore::CommitState::Loading, meta.blobState);
+    EXPECT_EQ(0u, store->getBlobIdsGeneration());
+    EXPECT_THAT(store->getBlobIds(), ElementsAre("/s/"));
+
+    // The first access waits for the store to be loaded
+    release.set_value();
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/s/blob", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, std::vector<uint8_t>{1, 2}));
+    EXPECT_TRUE(store->commit(session));
+    EXPECT_NE(0u, store->getBlobIdsGeneration());
+    EXPECT_THAT(store->getBlobIds(), ElementsAre("/s/", "/s/blob"));
+    EXPECT_TRUE(store->statBlob("/s/blob", &meta));
+    EXPECT_EQ(2, meta.size);
+    EXPECT_FALSE(meta.blobState & BinaryStore::CommitState::Loading);
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::committed);
+}
+
+TEST(DeferredBinaryStoreTest, EnumerationDoesNotWaitForLoad)
+{
+    std::promise<void> release;
+    auto released = release.get_future();
+    blobs::BinaryStoreBlobHandler handler;
+    handler.addNewBinaryStore(
+        DeferredBinaryStore::createInBackground("/s/", [&released] {
+            released.wait();
+            auto store = BinaryStore::createFromConfig(
+                "/s/", std::make_unique<FakeSysFile>());
+            store->openOrCreateBlob(session, "/s/blob", rwFlags);
+            store->commit(session);
+            store->close(session);
+            return store;
+        }));
+
+    // Only the base id is listed while the store is loading
+    EXPECT_THAT(handler.getBlobIds(), ElementsAre("/s/"));
+
+    // Finishing the load lists the loaded blobs
+    release.set_value();
+    blobs::BlobMeta meta;
+    meta.blobState = BinaryStore::CommitState::Loading;
+    for (int i = 0;
+         i < 1000 && (meta.blobState & BinaryStore::CommitState::Loading); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        EXPECT_TRUE(handler.stat("/s/", &meta));
+    }
+    EXPECT_FALSE(meta.blobState & BinaryStore::CommitState::Loading);
+    EXPECT_THAT(handler.getBlobIds(), ElementsAre("/s/", "/s/blob"));
+}
+
+TEST(DeferredBinaryStoreTest, FailedLoadFailsEveryAccess)
+{
+    auto store = DeferredBinaryStore::createInBackground(
+        "/s/", []() -> std::unique_ptr<BinaryStoreInterface> {
+            throw std::runtime_error("Can't open the sysfile");
+        });
+    ASSERT_TRUE(store);
+
+    EXPECT_FALSE(store->openOrCreateBlob(session, "/s/blob", rwFlags));
+    EXPECT_THROW(store->readBlob("/s/blob"), ipmi::HandlerCompletion);
+    EXPECT_THAT(store->getBlobIds(), ElementsAre("/s/"));
+    blobs::BlobMeta meta;
+    EXPECT_FALSE(store->stat(&meta));
+}
+
+TEST(DeferredBinaryStoreTest, InvalidConfigIsRejected)
+{
+    EXPECT_FALSE(DeferredBinaryStore::createInBackground("", [] {
+        return BinaryStore::createFromConfig("/s/",
+                                             std::make_unique<FakeSysFile>());
+    }));
+    EXPECT_FALSE(DeferredBinaryStore::createInBackground("/s/", nullptr));
+}
@@ -54,13 +54,12 @@ class FakeSysFile : public SysFile
 
     void writeStr(const std::string& data, size_t pos) override
     {
-        if (pos >= data.size())
+        if (pos > data_.size())
         {
-            return;
+            data_.resize(pos);
         }
 
-        data_.resize(pos);
-        data_.insert(data_.begin() + pos, data.begin(), data.end());
+        data_.replace(pos, data.size(), data);
     }
 
   protected:
@@ -0,0 +1,108 @@
+#include "fake_sys_file.hpp"
+#include "flat_image.hpp"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace binstore;
+
+static std::vector<flat::Extent> makeExtents(
+    const std::vector<std::pair<std::string, std::string>>& blobs)
+{
+    std::vector<flat::Extent> extents;
+    for (const auto& [id, data] : blobs)
+    {
+        extents.push_back({.id = id,
+                           .offset = 0,
+                           .length = static_cast<uint32_t>(data.size()),
+                           .capacity = 0,
+                           .crc = static_cast<uint32_t>(data.size())});
+    }
+    return extents;
+}
+
+static std::string encodeBlobs(
+    const std::vector<std::pair<std::string, std::string>>& blobs,
+    std::vector<flat::Extent>& extents, size_t maxSize = SIZE_MAX)
+{
+    const auto imageSize = flat::place("/s/", extents, maxSize);
+    return flat::encode("/s/", extents, imageSize, [&](size_t i) {
+        const auto& data = blobs[i].second;
+        return std::span<const uint8_t>(
+            reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    });
+}
+
+TEST(FlatImageTest, EncodedImageReadsBack)
+{
+    const std::vector<std::pair<std::string, std::string>> blobs = {
+        {"/s/a", "hello"}, {"/s/b", ""}, {"/s/c", std::string(100, 'c')}};
+    auto extents = makeExtents(blobs);
+    const auto image = encodeBlobs(blobs, extents);
+    EXPECT_TRUE(flat::isFlatImage(image));
+
+    const auto index = flat::readIndex(FakeSysFile(image));
+    ASSERT_TRUE(index);
+    EXPECT_EQ("/s/", index->baseId);
+    EXPECT_EQ(image.size(), index->imageSize);
+    EXPECT_EQ(image.substr(0, flat::alignUp(index->indexSize)),
+              flat::encodeIndex("/s/", extents, image.size()));
+    ASSERT_EQ(blobs.size(), index->blobs.size());
+    for (size_t i = 0; i < blobs.size(); ++i)
+    {
+        const auto& extent = index->blobs[i];
+        EXPECT_EQ(blobs[i].first, extent.id);
+        EXPECT_EQ(0u, extent.offset % flat::alignment);
+        EXPECT_EQ(blobs[i].second.size(), extent.crc);
+        EXPECT_EQ(blobs[i].second, image.substr(extent.offset, extent.length));
+    }
+}
+
+TEST(FlatImageTest, CorruptIndexIsRejected)
+{
+    const std::vector<std::pair<std::string, std::string>> blobs = {
+        {"/s/a", "hello"}};
+    auto extents = makeExtents(blobs);
+    auto image = encodeBlobs(blobs, extents);
+
+    EXPECT_FALSE(flat::isFlatImage("BSV"));
+    EXPECT_FALSE(flat::readIndex(FakeSysFile(image.substr(0, 40))));
+    image[sizeof(flat::Header) + 1] ^= 0x01;
+    EXPECT_FALSE(flat::readIndex(FakeSysFile(image)));
+}
+
+TEST(FlatImageTest, PlaceKeepsPayloadsThatStillFit)
+{
+    std::vector<std::pair<std::string, std::string>> blobs = {
+        {"/s/a", "aaaa"}, {"/s/b", "bbbb"}, {"/s/c", "cccc"}};
+    auto extents = makeExtents(blobs);
+    const auto first = encodeBlobs(blobs, extents);
+    const auto placed = extents;
+
+    // Shrinking a payload keeps it in place, growing one past its capacity
+    // moves it after the others
+    blobs[0].second = "a";
+    blobs[1].second = std::string(20, 'b');
+    extents[0].length = blobs[0].second.size();
+    extents[1].length = blobs[1].second.size();
+    const auto second = encodeBlobs(blobs, extents);
+    EXPECT_EQ(placed[0].offset, extents[0].offset);
+    EXPECT_EQ(placed[0].capacity, extents[0].capacity);
+    EXPECT_EQ(placed[2].offset, extents[2].offset);
+    EXPECT_EQ(first.size(), extents[1].offset);
+    EXPECT_EQ(first.size() + flat::alignUp(20), second.size());
+
+    // The image is packed again once it wouldn't fit otherwise
+    const auto packed = encodeBlobs(blobs, extents, first.size() + 16);
+    EXPECT_GE(first.size() + 16, packed.size());
+    EXPECT_LT(extents[0].offset, extents[1].offset);
+    EXPECT_LT(extents[1].offset, extents[2].offset);
+    const auto index = flat::readIndex(FakeSysFile(packed));
+    ASSERT_TRUE(index);
+    EXPECT_EQ(blobs[1].second, packed.substr(index->blobs[1].offset,
+                                             index->blobs[1].length));
+}
@@ -31,7 +31,7 @@ TEST_F(BinaryStoreBlobHandlerOpenTest, OpenFailWhenStoreOpenReturnsFailure)
 {
     auto store = defaultMockStore(openTestBaseId);
 
-    EXPECT_CALL(*store, openOrCreateBlob(_, openTestROFlags))
+    EXPECT_CALL(*store, openOrCreateBlob(_, _, openTestROFlags))
         .WillOnce(Return(false));
 
     handler.addNewBinaryStore(std::move(store));
@@ -44,7 +44,7 @@ TEST_F(BinaryStoreBlobHandlerOpenTest, OpenSucceedWhenStoreOpenReturnsTrue)
 {
     auto store = defaultMockStore(openTestBaseId);
 
-    EXPECT_CALL(*store, openOrCreateBlob(_, openTestROFlags))
+    EXPECT_CALL(*store, openOrCreateBlob(_, _, openTestROFlags))
         .WillOnce(Return(true));
 
     handler.addNewBinaryStore(std::move(store));
@@ -53,6 +53,56 @@ TEST_F(BinaryStoreBlobHandlerOpenTest, OpenSucceedWhenStoreOpenReturnsTrue)
         handler.open(openTestSessionId, openTestROFlags, openTestBlobId));
 }
 
+TEST_F(BinaryStoreBlobHandlerOpenTest, OpenSucceedForConcurrentSessions)
+{
+    uint16_t otherSessionId = 1;
+    uint16_t writerSessionId = 2;
+
+    addDefaultStore(openTestBaseId);
+
+    EXPECT_TRUE(
+        handler.open(openTestSessionId, openTestROFlags, openTestBlobId));
+    EXPECT_TRUE(handler.open(otherSessionId, openTestROFlags, openTestBlobId));
+    EXPECT_TRUE(
+        handler.open(writerSessionId, openTestRWFlags, openTestBlobId));
+    /* Only one session may write a blob */
+    EXPECT_FALSE(handler.open(3, openTestRWFlags, openTestBlobId));
+
+    EXPECT_TRUE(handler.write(writerSessionId, 0, {1, 2}));
+    EXPECT_EQ(handler.read(otherSessionId, 0, 2),
+              std::vector<uint8_t>({1, 2}));
+    EXPECT_TRUE(handler.close(openTestSessionId));
+    EXPECT_EQ(handler.read(otherSessionId, 0, 2),
+              std::vector<uint8_t>({1, 2}));
+}
+
+TEST_F(BinaryStoreBlobHandlerOpenTest, SessionsAcrossTheIdSpaceKeepTheirStore)
+{
+    addDefaultStore(openTestBaseId);
+    addDefaultStore("/other/");
+    const std::vector<std::pair<uint16_t, std::string>> sessions = {
+        {0x00ff, openTestBlobId},
+        {0x0100, "/other/blob0"},
+        {0xffff, "/other/blob1"},
+    };
+
+    for (const auto& [session, blobId] : sessions)
+    {
+        EXPECT_TRUE(handler.open(session, openTestRWFlags, blobId));
+        EXPECT_TRUE(handler.write(session, 0, {static_cast<uint8_t>(session)}));
+    }
+    EXPECT_FALSE(handler.open(0xffff, openTestROFlags, openTestBlobId));
+    EXPECT_FALSE(handler.close(0x01ff));
+
+    for (const auto& [session, blobId] : sessions)
+    {
+        EXPECT_EQ(handler.read(session, 0, 1),
+                  std::vector<uint8_t>({static_cast<uint8_t>(session)}));
+        EXPECT_TRUE(handler.close(session));
+        EXPECT_FALSE(handler.close(session));
+    }
+}
+
 TEST_F(BinaryStoreBlobHandlerOpenTest, OpenFailForNonMatchingBasePath)
 {
     addDefaultStore(openTestBaseId);
@@ -95,24 +145,40 @@ TEST_F(BinaryStoreBlobHandlerOpenTest, CloseFailWhenStoreCloseFails)
 {
     auto store = defaultMockStore(openTestBaseId);
 
-    EXPECT_CALL(*store, openOrCreateBlob(_, openTestROFlags))
+    EXPECT_CALL(*store, openOrCreateBlob(_, _, openTestROFlags))
+        .WillOnce(Return(true));
+    EXPECT_CALL(*store, close(_)).WillOnce(Return(false));
+
+    handler.addNewBinaryStore(std::move(store));
+
+    EXPECT_TRUE(
+        handler.open(openTestSessionId, openTestROFlags, openTestBlobId));
+    EXPECT_FALSE(handler.close(openTestSessionId));
+}
+
+TEST_F(BinaryStoreBlobHandlerOpenTest, FailedCloseStillEndsSession)
+{
+    auto store = defaultMockStore(openTestBaseId);
+
+    EXPECT_CALL(*store, openOrCreateBlob(_, _, openTestROFlags))
         .WillOnce(Return(true));
-    EXPECT_CALL(*store, close()).WillOnce(Return(false));
+    EXPECT_CALL(*store, close(_)).WillOnce(Return(false));
 
     handler.addNewBinaryStore(std::move(store));
 
     EXPECT_TRUE(
         handler.open(openTestSessionId, openTestROFlags, openTestBlobId));
     EXPECT_FALSE(handler.close(openTestSessionId));
+    EXPECT_FALSE(handler.close(openTestSessionId)); // Already closed
 }
 
 TEST_F(BinaryStoreBlobHandlerOpenTest, CloseSucceedWhenStoreCloseSucceeds)
 {
     auto store = defaultMockStore(openTestBaseId);
 
-    EXPECT_CALL(*store, openOrCreateBlob(_, openTestROFlags))
+    EXPECT_CALL(*store, openOrCreateBlob(_, _, openTestROFlags))
         .WillOnce(Return(true));
-    EXPECT_CALL(*store, close()).WillOnce(Return(true));
+    EXPECT_CALL(*store, close(_)).WillOnce(Return(true));
 
     handler.addNewBinaryStore(std::move(store));
 
@@ -125,9 +191,9 @@ TEST_F(BinaryStoreBlobHandlerOpenTest, ClosedSessionCannotBeReclosed)
 {
     auto store = defaultMockStore(openTestBaseId);
 
-    EXPECT_CALL(*store, openOrCreateBlob(_, openTestROFlags))
+    EXPECT_CALL(*store, openOrCreateBlob(_, _, openTestROFlags))
         .WillOnce(Return(true));
-    EXPECT_CALL(*store, close()).WillRepeatedly(Return(true));
+    EXPECT_CALL(*store, close(_)).WillRepeatedly(Return(true));
 
     handler.addNewBinaryStore(std::move(store));
 
@@ -45,14 +45,16 @@ TEST_F(BinaryStoreBlobHandlerReadWriteTest, ReadWriteReturnsWhatStoreReturns)
     const std::vector<uint8_t> emptyData;
     auto store = defaultMockStore(rwTestBaseId);
 
-    EXPECT_CALL(*store, openOrCreateBlob(_, rwTestRWFlags))
+    EXPECT_CALL(*store, openOrCreateBlob(_, _, rwTestRWFlags))
         .WillOnce(Return(true));
-    EXPECT_CALL(*store, read(rwTestOffset, _))
+    EXPECT_CALL(*store, read(_, rwTestOffset, _))
         .WillOnce(Return(emptyData))
         .WillOnce(Return(rwTestData));
 
-    EXPECT_CALL(*store, write(rwTestOffset, emptyData)).WillOnce(Return(false));
-    EXPECT_CALL(*store, write(rwTestOffset, rwTestData)).WillOnce(Return(true));
+    EXPECT_CALL(*store, write(_, rwTestOffset, emptyData))
+        .WillOnce(Return(false));
+    EXPECT_CALL(*store, write(_, rwTestOffset, rwTestData))
+        .WillOnce(Return(true));
 
     handler.addNewBinaryStore(std::move(store));
 
@@ -51,6 +51,25 @@ TEST_F(BinaryStoreBlobHandlerStatTest, InitialStatIsValidQueriedWithBlobId)
     EXPECT_EQ(meta.size, 0);
 };
 
+TEST_F(BinaryStoreBlobHandlerStatTest, StatByBlobIdDoesNotNeedSession)
+{
+    BlobMeta meta;
+
+    openAndWriteTestData();
+    commitData();
+    EXPECT_TRUE(handler.close(statTestSessionId));
+
+    EXPECT_TRUE(handler.stat(statTestBlobId, &meta));
+    EXPECT_EQ(meta.size, statTestData.size());
+    EXPECT_FALSE(meta.blobState & OpenFlags::read);
+    EXPECT_TRUE(meta.blobState & StateFlags::committed);
+    EXPECT_TRUE(meta.blobState & BinaryStore::CommitState::Clean);
+
+    /* The store itself reports no size */
+    EXPECT_TRUE(handler.stat(statTestBaseId, &meta));
+    EXPECT_EQ(meta.size, 0);
+}
+
 TEST_F(BinaryStoreBlobHandlerStatTest, StatShowsCommittedState)
 {
     BlobMeta meta;
@@ -147,6 +147,105 @@ TEST_F(BinaryStoreBlobHandlerBasicTest, DeleteReturnsWhatStoreReturns)
     EXPECT_TRUE(handler.deleteBlob(basicTestBlobId));
 }
 
+TEST_F(BinaryStoreBlobHandlerBasicTest, RenamedStoreIsRoutedByNewBaseId)
+{
+    const std::string emptyData;
+    handler.addNewBinaryStore(BinaryStore::createFromConfig(
+        basicTestBaseId, std::make_unique<FakeSysFile>(emptyData)));
+    handler.addNewBinaryStore(BinaryStore::createFromConfig(
+        "/another/", std::make_unique<FakeSysFile>(emptyData)));
+
+    // The new base id must not belong to another store
+    EXPECT_FALSE(handler.setBaseBlobId(basicTestBaseId, "/another/"));
+    EXPECT_FALSE(handler.setBaseBlobId("/missing/", "/renamed/"));
+
+    EXPECT_TRUE(handler.setBaseBlobId(basicTestBaseId, "/renamed/"));
+    EXPECT_FALSE(handler.canHandleBlob(basicTestBlobId));
+    EXPECT_TRUE(handler.canHandleBlob("/renamed/blob0"));
+    EXPECT_TRUE(handler.open(0, OpenFlags::read | OpenFlags::write,
+                             "/renamed/blob0"));
+    EXPECT_THAT(handler.getBlobIds(),
+                UnorderedElementsAreArray(
+                    {"/another/"s, "/renamed/"s, "/renamed/blob0"s}));
+}
+
+TEST_F(BinaryStoreBlobHandlerBasicTest, DirectlyRenamedStoreIsRoutedByNewId)
+{
+    const std::string emptyData;
+    auto store = BinaryStore::createFromConfig(
+        basicTestBaseId, std::make_unique<FakeSysFile>(emptyData));
+    auto* storePtr = store.get();
+    handler.addNewBinaryStore(std::move(store));
+    handler.addNewBinaryStore(BinaryStore::createFromConfig(
+        "/another/", std::make_unique<FakeSysFile>(emptyData)));
+    EXPECT_TRUE(handler.canHandleBlob(basicTestBlobId));
+
+    // Renaming the store without the handler still moves its route
+    EXPECT_TRUE(storePtr->setBaseBlobId("/renamed/"));
+    EXPECT_FALSE(handler.canHandleBlob(basicTestBlobId));
+    EXPECT_FALSE(handler.open(0, OpenFlags::read | OpenFlags::write,
+                              basicTestBlobId));
+    EXPECT_TRUE(handler.canHandleBlob("/renamed/blob0"));
+    EXPECT_TRUE(handler.open(0, OpenFlags::read | OpenFlags::write,
+                             "/renamed/blob0"));
+    EXPECT_TRUE(handler.canHandleBlob("/another/blob0"));
+
+    // The old id is free again
+    EXPECT_TRUE(handler.setBaseBlobId("/another/", basicTestBaseId));
+    EXPECT_TRUE(handler.canHandleBlob(basicTestBlobId));
+    EXPECT_THAT(handler.getBlobIds(),
+                UnorderedElementsAreArray(
+                    {std::string(basicTestBaseId), "/renamed/"s,
+                     "/renamed/blob0"s}));
+}
+
+TEST_F(BinaryStoreBlobHandlerBasicTest, BlobIdsAreCachedUntilTheyChange)
+{
+    auto store = defaultMockStore(basicTestBaseId);
+    EXPECT_CALL(*store, getBaseBlobId()).Times(AtLeast(1));
+    auto* storePtr = store.get();
+    handler.addNewBinaryStore(std::move(store));
+
+    // Repeated enumerations don't ask the store again
+    EXPECT_CALL(*storePtr, getBlobIds()).Times(1);
+    const std::vector<std::string> baseOnly = {basicTestBaseId};
+    EXPECT_EQ(baseOnly, handler.getBlobIds());
+    EXPECT_EQ(baseOnly, handler.getBlobIds());
+    testing::Mock::VerifyAndClearExpectations(storePtr);
+
+    // Creating a blob invalidates the cached list
+    EXPECT_CALL(*storePtr, openOrCreateBlob(_, _, _)).Times(1);
+    EXPECT_CALL(*storePtr, getBlobIds()).Times(1);
+    EXPECT_TRUE(handler.open(0, OpenFlags::read | OpenFlags::write,
+                             basicTestBlobId));
+    const std::vector<std::string> withBlob = {basicTestBaseId,
+                                               basicTestBlobId};
+    EXPECT_EQ(withBlob, handler.getBlobIds());
+    EXPECT_EQ(withBlob, handler.getBlobIds());
+}
+
+TEST_F(BinaryStoreBlobHandlerBasicTest, EnumerateWalkAsksEachStoreOnce)
+{
+    std::vector<MockBinaryStore*> stores;
+    for (const auto& baseId : basicTestBaseIdList)
+    {
+        auto store = defaultMockStore(baseId);
+        EXPECT_CALL(*store, getBaseBlobId()).Times(AtLeast(1));
+        EXPECT_CALL(*store, getBlobIds()).Times(1);
+        stores.push_back(store.get());
+        handler.addNewBinaryStore(std::move(store));
+    }
+
+    // The blob manager enumerates one index at a time, calling getBlobIds()
+    // once per index. Only the first call may rebuild the list from stores.
+    const auto ids = handler.getBlobIds();
+    ASSERT_EQ(basicTestBaseIdList.size(), ids.size());
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        EXPECT_EQ(ids, handler.getBlobIds());
+    }
+}
+
 TEST_F(BinaryStoreBlobHandlerBasicTest, StaleDataIsClearedDuringCreation)
 {
     using namespace google::protobuf;
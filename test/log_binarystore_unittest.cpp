@@ -0,0 +1,315 @@
+#include "binarystore_interface.hpp"
+#include "log_binarystore.hpp"
+#include "sys_file.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <ipmid/handler.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gmock/gmock.h>
+
+using binstore::BinaryStoreInterface;
+using binstore::LogBinaryStore;
+
+using testing::ElementsAre;
+using testing::ElementsAreArray;
+
+constexpr uint16_t session = 0;
+constexpr uint16_t rwFlags = blobs::OpenFlags::read | blobs::OpenFlags::write;
+
+/* Sysfile on a string owned by the test, so it outlives the store */
+class LogSysFileBuf : public binstore::SysFile
+{
+  public:
+    explicit LogSysFileBuf(std::string* storage) : data_{storage}
+    {
+    }
+
+    size_t readToBuf(size_t pos, size_t count, char* buf) const override
+    {
+        return pos < data_->size() ? data_->copy(buf, count, pos) : 0;
+    }
+
+    std::string readAsStr(size_t pos, size_t count) const override
+    {
+        return pos < data_->size() ? data_->substr(pos, count) : "";
+    }
+
+    std::string readRemainingAsStr(size_t pos) const override
+    {
+        return readAsStr(pos, data_->size());
+    }
+
+    void writeStr(const std::string& data, size_t pos) override
+    {
+        if (pos > data_->size())
+        {
+            data_->resize(pos);
+        }
+        data_->replace(pos, data.size(), data);
+    }
+
+    std::string* data_;
+};
+
+class LogBinaryStoreTest : public testing::Test
+{
+  public:
+    std::unique_ptr<BinaryStoreInterface>
+        createStore(const binstore::StoreOptions& options = {},
+                    std::optional<uint32_t> maxSize = std::nullopt,
+                    const std::string& baseId = "/log/test")
+    {
+        return LogBinaryStore::createFromConfig(
+            baseId, std::make_unique<LogSysFileBuf>(&storage), maxSize,
+            options);
+    }
+
+    const binstore::CommitStats&
+        commitStats(const std::unique_ptr<BinaryStoreInterface>& store)
+    {
+        return dynamic_cast<LogBinaryStore&>(*store).getCommitStats();
+    }
+
+    void writeBlob(const std::unique_ptr<BinaryStoreInterface>& store,
+                   const std::string& blobId, uint32_t offset,
+                   const std::vector<uint8_t>& data)
+    {
+        EXPECT_TRUE(store->openOrCreateBlob(session, blobId, rwFlags));
+        EXPECT_TRUE(store->write(session, offset, data));
+        EXPECT_TRUE(store->commit(session));
+        EXPECT_TRUE(store->close(session));
+    }
+
+    std::string storage;
+};
+
+TEST_F(LogBinaryStoreTest, EmptyStoreIsUninitialized)
+{
+    auto store = createStore();
+    ASSERT_TRUE(store);
+    EXPECT_THAT(store->getBlobIds(), ElementsAre("/log/test"));
+
+    blobs::BlobMeta meta;
+    EXPECT_TRUE(store->stat(&meta));
+    EXPECT_TRUE(meta.blobState & LogBinaryStore::CommitState::Uninitialized);
+}
+
+TEST_F(LogBinaryStoreTest, ReplaysCommittedWritesOnReopen)
+{
+    auto store = createStore();
+    writeBlob(store, "/log/test/0", 0, {1, 2, 3, 4});
+    writeBlob(store, "/log/test/1", 0, {5, 6});
+    writeBlob(store, "/log/test/0", 2, {7, 8, 9});
+
+    auto reloaded = createStore();
+    ASSERT_TRUE(reloaded);
+    EXPECT_THAT(reloaded->getBlobIds(),
+                ElementsAre("/log/test", "/log/test/0", "/log/test/1"));
+    EXPECT_THAT(reloaded->readBlob("/log/test/0"),
+                ElementsAre(1, 2, 7, 8, 9));
+    EXPECT_THAT(reloaded->readBlob("/log/test/1"), ElementsAre(5, 6));
+
+    blobs::BlobMeta meta;
+    EXPECT_TRUE(reloaded->statBlob("/log/test/0", &meta));
+    EXPECT_EQ(5, meta.size);
+    EXPECT_TRUE(meta.blobState & blobs::StateFlags::committed);
+}
+
+TEST_F(LogBinaryStoreTest, CommitCostFollowsChangeSize)
+{
+    auto store = createStore();
+    writeBlob(store, "/log/test/0", 0, std::vector<uint8_t>(4096, 0xaa));
+    const auto before = commitStats(store);
+
+    writeBlob(store, "/log/test/0", 100, {1, 2, 3});
+    const auto& after = commitStats(store);
+    EXPECT_EQ(after.commits, before.commits + 1);
+    EXPECT_LT(after.bytesWritten - before.bytesWritten, 64);
+
+    auto reloaded = createStore();
+    auto data = reloaded->readBlob("/log/test/0");
+    ASSERT_EQ(data.size(), 4096);
+    EXPECT_THAT(std::vector<uint8_t>(data.begin() + 99, data.begin() + 104),
+                ElementsAre(0xaa, 1, 2, 3, 0xaa));
+}
+
+TEST_F(LogBinaryStoreTest, UncommittedWritesAreDiscarded)
+{
+    auto store = createStore();
+    writeBlob(store, "/log/test/0", 0, {1, 2, 3});
+
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/log/test/0", rwFlags));
+    EXPECT_TRUE(store->write(session, 0, {9, 9}));
+    EXPECT_TRUE(store->close(session));
+
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/log/test/0",
+                                        blobs::OpenFlags::read));
+    EXPECT_THAT(store->read(session, 0, 10), ElementsAre(1, 2, 3));
+    EXPECT_TRUE(store->close(session));
+}
+
+TEST_F(LogBinaryStoreTest, TornAppendIsIgnored)
+{
+    auto store = createStore();
+    writeBlob(store, "/log/test/0", 0, {1, 2, 3});
+    const size_t intactSize = storage.size();
+    writeBlob(store, "/log/test/0", 0, {4, 5, 6, 7, 8, 9});
+
+    /* Power loss in the middle of the last append */
+    storage.resize(storage.size() - 3);
+    auto reloaded = createStore();
+    ASSERT_TRUE(reloaded);
+    EXPECT_THAT(reloaded->readBlob("/log/test/0"), ElementsAre(1, 2, 3));
+
+    /* The next append overwrites the torn record */
+    writeBlob(reloaded, "/log/test/0", 3, {4});
+    EXPECT_GT(storage.size(), intactSize);
+    EXPECT_THAT(createStore()->readBlob("/log/test/0"),
+                ElementsAre(1, 2, 3, 4));
+}
+
+TEST_F(LogBinaryStoreTest, CompactsOnceThresholdIsExceeded)
+{
+    binstore::StoreOptions options;
+    options.logCompactionThreshold = 256;
+    auto store = createStore(options);
+    writeBlob(store, "/log/test/0", 0, std::vector<uint8_t>(32, 0));
+
+    for (uint8_t i = 1; i <= 32; ++i)
+    {
+        writeBlob(store, "/log/test/0", 0, std::vector<uint8_t>(32, i));
+        /* Appended records never grow far past the threshold, next to the
+         * previous base and the one they are appended to */
+        EXPECT_LT(storage.size(), 768);
+    }
+
+    auto reloaded = createStore(options);
+    EXPECT_THAT(reloaded->readBlob("/log/test/0"),
+                ElementsAreArray(std::vector<uint8_t>(32, 32)));
+}
+
+TEST_F(LogBinaryStoreTest, CompactsToFitMaxSize)
+{
+    auto store = createStore({}, 512);
+    writeBlob(store, "/log/test/0", 0, std::vector<uint8_t>(64, 0));
+    for (uint8_t i = 1; i <= 8; ++i)
+    {
+        writeBlob(store, "/log/test/0", 0, std::vector<uint8_t>(64, i));
+        EXPECT_LE(storage.size(), 512);
+    }
+
+    /* Only the compacted store has to fit, twice so the next base can be
+     * written before switching to it */
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/log/test/0", rwFlags));
+    EXPECT_FALSE(store->write(session, 64, std::vector<uint8_t>(128, 0)));
+    EXPECT_TRUE(store->close(session));
+
+    EXPECT_THAT(createStore({}, 512)->readBlob("/log/test/0"),
+                ElementsAreArray(std::vector<uint8_t>(64, 8)));
+}
+
+TEST_F(LogBinaryStoreTest, InterruptedCompactionKeepsPreviousBase)
+{
+    binstore::StoreOptions options;
+    options.logCompactionThreshold = 0;
+    auto store = createStore(options, 512);
+    writeBlob(store, "/log/test/0", 0, std::vector<uint8_t>(64, 1));
+    const auto before = storage;
+
+    /* Every commit compacts, each time next to the previous base */
+    writeBlob(store, "/log/test/0", 0, std::vector<uint8_t>(64, 2));
+    const auto after = storage;
+    EXPECT_EQ(std::vector<uint8_t>(64, 2),
+              createStore(options, 512)->readBlob("/log/test/0"));
+
+    /* Power loss while writing the base, before the headers change */
+    constexpr size_t headersSize = 64;
+    storage = after;
+    std::copy_n(before.begin(), headersSize, storage.begin());
+    storage[storage.size() - 3] ^= 0xff;
+    EXPECT_EQ(std::vector<uint8_t>(64, 1),
+              createStore(options, 512)->readBlob("/log/test/0"));
+
+    /* or while writing the header that changed */
+    storage = after;
+    for (size_t pos = 0; pos < headersSize; ++pos)
+    {
+        if (storage[pos] != before[pos])
+        {
+            storage[pos] ^= 0xff;
+            break;
+        }
+    }
+    EXPECT_EQ(std::vector<uint8_t>(64, 1),
+              createStore(options, 512)->readBlob("/log/test/0"));
+
+    /* Compacting again from there doesn't overwrite the base it loaded */
+    auto reloaded = createStore(options, 512);
+    writeBlob(reloaded, "/log/test/0", 0, std::vector<uint8_t>(64, 3));
+    EXPECT_EQ(std::vector<uint8_t>(64, 3),
+              createStore(options, 512)->readBlob("/log/test/0"));
+}
+
+TEST_F(LogBinaryStoreTest, StaleBaseIdIsReset)
+{
+    auto store = createStore();
+    writeBlob(store, "/log/test/0", 0, {1, 2, 3});
+
+    auto other = createStore({}, std::nullopt, "/log/other");
+    ASSERT_TRUE(other);
+    EXPECT_THAT(other->getBlobIds(), ElementsAre("/log/other"));
+
+    auto reloaded = createStore({}, std::nullopt, "/log/other");
+    EXPECT_THAT(reloaded->getBlobIds(), ElementsAre("/log/other"));
+}
+
+TEST_F(LogBinaryStoreTest, SetBaseBlobIdRenamesBlobs)
+{
+    auto store = createStore();
+    writeBlob(store, "/log/test/0", 0, {1, 2, 3});
+    EXPECT_TRUE(store->openOrCreateBlob(session, "/log/test/0",
+                                        blobs::OpenFlags::read));
+    EXPECT_TRUE(store->setBaseBlobId("/log/new"));
+    EXPECT_THAT(store->getBlobIds(), ElementsAre("/log/new", "/log/new/0"));
+    EXPECT_THAT(store->readBlob("/log/new/0"), ElementsAre(1, 2, 3));
+    EXPECT_THROW(store->readBlob("/log/test/0"), ipmi::HandlerCompletion);
+    EXPECT_THAT(store->readView(session, 0, 3), ElementsAre(1, 2, 3));
+    EXPECT_TRUE(store->close(session));
+
+    auto reloaded = createStore({}, std::nullopt, "/log/new");
+    EXPECT_THAT(reloaded->getBlobIds(),
+                ElementsAre("/log/new", "/log/new/0"));
+    EXPECT_THAT(reloaded->readBlob("/log/new/0"), ElementsAre(1, 2, 3));
+}
+
+TEST_F(LogBinaryStoreTest, DeleteAppendsTombstone)
+{
+    auto store = createStore();
+    writeBlob(store, "/log/test/0", 0, std::vector<uint8_t>(1024, 1));
+    writeBlob(store, "/log/test/1", 0, {2});
+
+    EXPECT_TRUE(store->openOrCreateBlob(
+        session, "/log/test/0", blobs::OpenFlags::read));
+    EXPECT_FALSE(store->deleteBlob("/log/test/0"));
+    EXPECT_TRUE(store->close(session));
+    EXPECT_FALSE(store->deleteBlob("/log/test/2"));
+
+    const auto before = commitStats(store);
+    EXPECT_TRUE(store->deleteBlob("/log/test/0"));
+    EXPECT_LT(commitStats(store).bytesWritten - before.bytesWritten, 64);
+    EXPECT_THAT(store->getBlobIds(), ElementsAre("/log/test", "/log/test/1"));
+
+    auto reloaded = createStore();
+    EXPECT_THAT(reloaded->getBlobIds(),
+                ElementsAre("/log/test", "/log/test/1"));
+
+    /* Compaction drops the deleted data */
+    EXPECT_TRUE(reloaded->setBaseBlobId("/log/test"));
+    EXPECT_LT(commitStats(reloaded).bytesWritten, 128);
+    EXPECT_THAT(createStore()->getBlobIds(),
+                ElementsAre("/log/test", "/log/test/1"));
+}
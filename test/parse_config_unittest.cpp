@@ -28,7 +28,19 @@ TEST(ParseConfigTest, TestSimpleConfig)
       "offsetBytes": 32,
       "maxSizeBytes": 2,
       "aliasBlobBaseId": "/test2/",
-      "migrateToAlias": true
+      "migrateToAlias": true,
+      "deltaCommitGranularityBytes": 16,
+      "lazyLoad": true,
+      "slotSizeBytes": 4096,
+      "engine": "image",
+      "logCompactionThresholdBytes": 1024,
+      "asyncCommit": true,
+      "writeBackDelayMs": 500,
+      "writeBackDirtyBytes": 4096,
+      "compression": "lz4",
+      "format": "flat",
+      "deferredLoad": true,
+      "checksums": true
     }
   )"_json;
 
@@ -41,6 +53,112 @@ TEST(ParseConfigTest, TestSimpleConfig)
     EXPECT_EQ(config.maxSizeBytes, 2);
     EXPECT_EQ(config.aliasBlobBaseId, "/test2/");
     EXPECT_TRUE(config.migrateToAlias);
+    EXPECT_EQ(config.deltaCommitGranularityBytes, 16);
+    EXPECT_TRUE(config.lazyLoad);
+    EXPECT_EQ(config.slotSizeBytes, 4096);
+    EXPECT_EQ(config.engine, StoreEngine::Image);
+    EXPECT_EQ(config.logCompactionThresholdBytes, 1024);
+    EXPECT_TRUE(config.asyncCommit);
+    EXPECT_EQ(config.writeBackDelayMs, 500);
+    EXPECT_EQ(config.writeBackDirtyBytes, 4096);
+    EXPECT_EQ(config.compression, Compression::Lz4);
+    EXPECT_EQ(config.format, ImageFormat::Flat);
+    EXPECT_TRUE(config.deferredLoad);
+    EXPECT_TRUE(config.checksums);
+    EXPECT_TRUE(getStoreOptions(config).checksums);
+    EXPECT_EQ(getStoreOptions(config).deltaCommitGranularity, 16);
+    EXPECT_TRUE(getStoreOptions(config).lazyLoad);
+    EXPECT_EQ(getStoreOptions(config).slotSize, 4096);
+    EXPECT_EQ(getStoreOptions(config).logCompactionThreshold, 1024);
+    EXPECT_TRUE(getStoreOptions(config).asyncCommit);
+    EXPECT_EQ(getStoreOptions(config).writeBackDelay,
+              std::chrono::milliseconds(500));
+    EXPECT_EQ(getStoreOptions(config).writeBackDirtyBytes, 4096);
+    EXPECT_EQ(getStoreOptions(config).compression, Compression::Lz4);
+    EXPECT_EQ(getStoreOptions(config).format, ImageFormat::Flat);
+}
+
+TEST(ParseConfigTest, ExceptionOnUnknownEngine)
+{
+    auto j = R"(
+    {
+      "blobBaseId": "/test/",
+      "sysFilePath": "/sys/fake/path",
+      "engine": "tape"
+    }
+  )"_json;
+
+    BinaryBlobConfig config;
+
+    EXPECT_THROW(parseFromConfigFile(j, config), std::invalid_argument);
+}
+
+TEST(ParseConfigTest, TestLogEngineConfig)
+{
+    auto j = R"(
+    {
+      "blobBaseId": "/test/",
+      "sysFilePath": "/sys/fake/path",
+      "maxSizeBytes": 4096,
+      "engine": "log",
+      "logCompactionThresholdBytes": 1024,
+      "deferredLoad": true
+    }
+  )"_json;
+
+    BinaryBlobConfig config;
+
+    EXPECT_NO_THROW(parseFromConfigFile(j, config));
+    EXPECT_EQ(config.engine, StoreEngine::Log);
+    EXPECT_EQ(getStoreOptions(config).logCompactionThreshold, 1024);
+}
+
+TEST(ParseConfigTest, ExceptionOnImageSettingsWithLogEngine)
+{
+    for (const auto* key : imageEngineKeys)
+    {
+        json j = {
+            {"blobBaseId", "/test/"},
+            {"sysFilePath", "/sys/fake/path"},
+            {"engine", "log"},
+            {key, true},
+        };
+
+        BinaryBlobConfig config;
+
+        EXPECT_THROW(parseFromConfigFile(j, config), std::invalid_argument)
+            << key;
+    }
+}
+
+TEST(ParseConfigTest, ExceptionOnUnknownCompression)
+{
+    auto j = R"(
+    {
+      "blobBaseId": "/test/",
+      "sysFilePath": "/sys/fake/path",
+      "compression": "zip"
+    }
+  )"_json;
+
+    BinaryBlobConfig config;
+
+    EXPECT_THROW(parseFromConfigFile(j, config), std::invalid_argument);
+}
+
+TEST(ParseConfigTest, ExceptionOnUnknownFormat)
+{
+    auto j = R"(
+    {
+      "blobBaseId": "/test/",
+      "sysFilePath": "/sys/fake/path",
+      "format": "xml"
+    }
+  )"_json;
+
+    BinaryBlobConfig config;
+
+    EXPECT_THROW(parseFromConfigFile(j, config), std::invalid_argument);
 }
 
 TEST(ParseConfigTest, TestConfigArray)
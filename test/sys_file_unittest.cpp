@@ -1,4 +1,6 @@
+#include "fake_sys_file.hpp"
 #include "sys_file_impl.hpp"
+#include "sys_file_view.hpp"
 #include "sys_mock.hpp"
 
 #include <fcntl.h>
@@ -127,3 +129,23 @@ TEST_F(SysFileTest, ReadRemainingBeyondEndReturnsEmpty)
 
     EXPECT_THAT(file->readRemainingAsStr(largeOffset), IsEmpty());
 }
+
+TEST(SysFileViewTest, AccessIsRelativeAndBounded)
+{
+    FakeSysFile file("0123456789");
+    SysFileView view(file, 2, 5);
+
+    EXPECT_EQ("234"s, view.readAsStr(0, 3));
+    EXPECT_EQ("56"s, view.readAsStr(3, 10));
+    EXPECT_EQ("456"s, view.readRemainingAsStr(2));
+    EXPECT_THAT(view.readAsStr(5, 1), IsEmpty());
+
+    char buf[8] = {};
+    EXPECT_EQ(5u, view.readToBuf(0, sizeof(buf), buf));
+    EXPECT_EQ("23456"s, std::string(buf, 5));
+
+    view.writeStr("ab", 3);
+    EXPECT_EQ("01234ab789"s, file.readRemainingAsStr(0));
+    EXPECT_THROW(view.writeStr("xyz", 3), std::system_error);
+    EXPECT_EQ("01234ab789"s, file.readRemainingAsStr(0));
+}